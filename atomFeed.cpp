@@ -14,6 +14,17 @@
 #include "atomFeed.h"
 #include "atomEntry.h"
 #include "gAPI.h"
+#include "feedParser.h"
+#include "curlRequest.h"
+
+#include <iostream>
+#include <sstream>
+#include <deque>
+#include <stdlib.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #ifndef TIXML_USE_TICPP
 #define TIXML_USE_TICPP
@@ -23,11 +34,15 @@
 
 using namespace std;
 
-atomFeed::atomFeed(const atomFeed& a): atomObj(a)
+// The largest page the Picasa API returns
+const int atomFeed::pageSize = 1000;
+const int atomFeed::maxParallelPages = 4;
+
+atomFeed::atomFeed(const atomFeed& a): atomObj(a), status(a.status)
 {
 }
 
-atomFeed::atomFeed( gAPI *API ): atomObj(API) {}
+atomFeed::atomFeed( gAPI *API ): atomObj(API), status(-1) {}
 
 bool atomFeed::addNewEntry( atomEntry *entry ) { 
   return entry->loadFromXML( api->POST( selfURL, entry->getStringXML() ) );
@@ -43,8 +58,164 @@ std::list<atomEntryPtr> atomFeed::getEntries() {
   return ret;
 }
 
+void atomFeed::streamedEntry( entryCallback cb, bool partial, const string &entryXML ) {
+  atomEntryPtr ent( new atomEntry( api ) );
+  if ( ! ent->loadFromXML( entryXML ) ) return; // already reported, skip it
+  ent->partial = partial;
+  cb( ent );
+}
+
+static void feedChunk( feedParser *parser, const char *data, size_t len ) {
+  if ( len == 0 ) parser->reset(); // the transfer starts over
+  else parser->feed( data, len );
+}
+
+bool atomFeed::streamEntries( const string &URL, entryCallback cb, const string &fields ) {
+  return streamEntryXML( URL, boost::bind( &atomFeed::streamedEntry, this, cb, ( fields != "" ), _1 ), fields );
+}
+
+bool atomFeed::streamEntryXML( const string &URL, xmlCallback cb, const string &fields ) {
+  feedParser parser( cb );
+  if ( ! api->STREAM( URL, boost::bind( feedChunk, &parser, _1, _2 ), fields, &status ) ) return false;
+  if ( ! parser.finish() ) {
+    cerr << "atomFeed::streamEntries(" << URL << "): truncated feed after " << parser.entryCount() << " entries\n";
+    return false;
+  }
+  return loadFromXML( parser.getFeedXML() );
+}
+
 
 
   
 
 
+
+long atomFeed::totalResults() const {
+  try {
+    return atol( getAttr( "openSearch:totalResults" ).c_str() );
+  } catch ( enum atomObj::exceptionType ex ) {
+    return -1;
+  }
+}
+
+static string pageURL( const string &URL, long startIndex ) {
+  ostringstream ret;
+  ret << URL << ( URL.find( '?' ) == string::npos ? '?' : '&' ) << "start-index=" << startIndex << "&max-results=" << atomFeed::pageSize;
+  return ret.str();
+}
+
+/* A page fetched in the background. Its entries are kept as XML (much
+ * smaller than parsed) until the caller gets to the page, from then on they
+ * are handed over as they arrive. */
+struct feedPage {
+  string URL, fields;
+  boost::mutex mutex;
+  boost::condition_variable arrived;
+  list<string> entries;
+  bool finished;
+  long total;
+  bool ok;
+  int error; // the gAPI exception thrown while fetching the page, -1 if none
+  boost::shared_ptr<boost::thread> fetcher;
+};
+
+static void collectEntry( boost::shared_ptr<struct feedPage> page, const string &entryXML ) {
+  boost::mutex::scoped_lock l(page->mutex);
+  page->entries.push_back( entryXML );
+  page->arrived.notify_all();
+}
+
+static void fetchPage( gAPI *api, enum curlRequest::deadlineClass cls, boost::shared_ptr<struct feedPage> page ) {
+  // The page is waited for just like the first one
+  curlRequest::deadlineScope scope( cls );
+  atomFeed feed( api );
+  bool ok = false;
+  long total = -1;
+  int error = -1;
+  try {
+    ok = feed.streamEntryXML( page->URL, boost::bind( collectEntry, page, _1 ), page->fields );
+    total = feed.totalResults();
+  } catch ( enum gAPI::exceptionType ex ) {
+    error = ex;
+  }
+  curlRequest::releaseThreadHandle();
+  boost::mutex::scoped_lock l(page->mutex);
+  page->ok = ok;
+  page->total = total;
+  page->error = error;
+  page->finished = true;
+  page->arrived.notify_all();
+}
+
+static void countEntry( long *count, atomFeed::entryCallback cb, atomEntryPtr entry ) {
+  (*count)++;
+  cb( entry );
+}
+
+/* Hands the entries of page to cb as they arrive, until it is fetched */
+void atomFeed::deliverPage( boost::shared_ptr<struct feedPage> page, entryCallback cb, long *delivered ) {
+  // The caller may be a worker woken up by interrupts, which must not abort the wait
+  boost::this_thread::disable_interruption di;
+  boost::mutex::scoped_lock l(page->mutex);
+  while( true ) {
+    while( page->entries.empty() && ! page->finished ) page->arrived.wait( l );
+    if ( page->entries.empty() ) break;
+    list<string> batch;
+    batch.swap( page->entries );
+    l.unlock();
+    for( list<string>::iterator e = batch.begin(); e != batch.end(); ++e )
+      streamedEntry( boost::bind( countEntry, delivered, cb, _1 ), ( page->fields != "" ), *e );
+    l.lock();
+  }
+  l.unlock();
+  page->fetcher->join();
+}
+
+bool atomFeed::streamPagedEntries( const string &URL, entryCallback cb, const string &fields ) {
+  long delivered = 0;
+  if ( ! streamEntries( pageURL( URL, 1 ), boost::bind( countEntry, &delivered, cb, _1 ), fields ) ) return false;
+  long total = totalResults();
+  if ( total <= delivered ) return true; // everything was on the first page (or the feed is not paged)
+  if ( delivered == 0 ) return false;
+
+  /* The pages start where we asked them to, a short first page means
+   * entries are missing (which the final count tells) */
+  long nextStart = 1 + pageSize;
+  bool ok = true;
+  deque< boost::shared_ptr<struct feedPage> > window;
+  while( nextStart <= total || ! window.empty() ) {
+    while( nextStart <= total && window.size() < (size_t) maxParallelPages ) {
+      boost::shared_ptr<struct feedPage> page( new struct feedPage );
+      page->URL = pageURL( URL, nextStart );
+      page->fields = fields;
+      page->finished = false;
+      page->total = -1;
+      page->ok = false;
+      page->error = -1;
+      page->fetcher.reset( new boost::thread( boost::bind( fetchPage, api, curlRequest::currentClass(), page ) ) );
+      window.push_back( page );
+      nextStart += pageSize;
+    }
+    boost::shared_ptr<struct feedPage> page = window.front();
+    window.pop_front();
+    deliverPage( page, cb, &delivered );
+    if ( page->error >= 0 || ! page->ok ) {
+      // Let the pages already running finish before giving up
+      nextStart = total + 1;
+      ok = false;
+      if ( page->error >= 0 ) {
+	for( ; ! window.empty(); window.pop_front() ) {
+	  boost::this_thread::disable_interruption di;
+	  window.front()->fetcher->join();
+	}
+	throw (enum gAPI::exceptionType) page->error;
+      }
+      continue;
+    }
+    if ( page->total != total ) {
+      cerr << "atomFeed::streamPagedEntries(" << URL << "): the feed changed while it was being fetched\n";
+      ok = false;
+    }
+  }
+  return ( ok && delivered >= total );
+}
@@ -18,9 +18,11 @@
 #include <string>
 #include <list>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
 
 class gAPI;
 class atomEntry;
+struct feedPage;
 
 namespace ticpp { 
   class Document;
@@ -29,11 +31,48 @@ namespace ticpp {
 typedef boost::shared_ptr<atomEntry> atomEntryPtr;
 
 class atomFeed : public atomObj { 
+	public:
+		typedef boost::function<void (atomEntryPtr)> entryCallback;
+		typedef boost::function<void (const std::string &)> xmlCallback;
+
+	private:
+		int status; // of the last streamed request, -1 if there was none
+		void streamedEntry( entryCallback cb, bool partial, const std::string &entryXML );
+		void deliverPage( boost::shared_ptr<struct feedPage> page, entryCallback cb, long *delivered );
+
 	public:
 		atomFeed( const atomFeed& a );
 		atomFeed( gAPI *api );		
 		bool addNewEntry( atomEntry *entry );
 		std::list<atomEntryPtr> getEntries();
+
+		/* Downloads the feed from URL calling cb with each entry as soon as
+		 * it has arrived, so that it can be processed during the transfer.
+		 * The feed itself (without the entries) is loaded into this object.
+		 * Returns false if the feed could not be downloaded completely (cb
+		 * may have been called for some of the entries). If fields is not
+		 * empty, only those fields are requested (see gAPI::STREAM) and the
+		 * entries are marked as partial. */
+		bool streamEntries( const std::string &URL, entryCallback cb, const std::string &fields = "" );
+		// Like streamEntries, but cb gets the entries as they are (not parsed)
+		bool streamEntryXML( const std::string &URL, xmlCallback cb, const std::string &fields = "" );
+
+		/* Like streamEntries, but fetches the feed in pages of pageSize
+		 * entries. The first page tells how many entries there are, the
+		 * other pages are then downloaded in parallel (at most maxParallelPages
+		 * at a time). cb is called from the calling thread, with the entries
+		 * in feed order; the pages ahead of the one being delivered keep
+		 * their entries as XML. Returns false if any page failed or the feed changed
+		 * while it was being fetched (so some entries might be missing). */
+		bool streamPagedEntries( const std::string &URL, entryCallback cb, const std::string &fields = "" );
+		static const int pageSize;
+		static const int maxParallelPages;
+
+		// The value of openSearch:totalResults, -1 if the feed does not have it
+		long totalResults() const;
+		/* The HTTP status of the last streamed request (of the first page
+		 * for streamPagedEntries), -1 if it did not get an answer */
+		int getStatus() const { return status; };
 		
 
 		friend class picasaAlbum;
@@ -12,21 +12,26 @@
  ***************************************************************/
 #include "atomObj.h"
 #include "gAPI.h" 
+#include "bufferPool.h"
 
 #ifndef TIXML_USE_TICPP
 #define TIXML_USE_TICPP
 #endif
 #include "ticpp/ticpp.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
 #include <iostream>
 
 using namespace std;
 
 
-atomObj::atomObj( gAPI *API ): api(API) {};
+atomObj::atomObj( gAPI *API ): api(API), partial(false) {};
 atomObj::atomObj( const atomObj& a ): 
   api(a.api), xml(a.xml), 
-  selfURL(a.selfURL), editURL(a.editURL), altURL(a.altURL)
+  selfURL(a.selfURL), editURL(a.editURL), altURL(a.altURL), partial(a.partial)
 {
 }
 
@@ -36,6 +41,7 @@ bool atomObj::operator<( const atomObj &a ) const {
 
 bool atomObj::loadFromXML( const string & data ) {
   xml.reset();
+  partial = false;
   try {
     ticppDocumentPtr p(new ticpp::Document());
     xml = p;
@@ -54,8 +60,9 @@ bool atomObj::loadFromXML( const string & data ) {
 };
  
 bool atomObj::loadFromURL( const string & URL ) { 
-  string data  = api->GET( URL );
-  return loadFromXML( data );
+  pooledBuffer data;
+  api->GET( URL, data.str() );
+  return loadFromXML( data.str() );
 };
 
 bool atomObj::loadFromFile( const string & fileName )  {
@@ -109,9 +116,10 @@ void atomObj::writeToFile( const string & fileName ) {
 }
 
 string atomObj::getStringXML() { 
-  ostringstream oss( ostringstream::out );
-  oss << *xml;
-  return oss.str();
+  TiXmlPrinter printer;
+  printer.SetStreamPrinting();
+  xml->Accept( &printer );
+  return printer.Str();
 }
 
 ticppDocumentPtr atomObj::getXML() {
@@ -121,10 +129,10 @@ ticppDocumentPtr atomObj::getXML() {
 
 void atomObj::addOrSet( ticpp::Element *where, const string name, const string value ) { 
   try { 
-  ticpp::Element *elm = where->FirstChildElement(name);
+  ticpp::Element *elm = where->FirstChildElement(name, false);
   if ( ! elm ) { 
     ticpp::Element nelm(name, value);
-    elm->InsertEndChild( nelm );
+    where->InsertEndChild( nelm );
   } else { 
     elm->SetText( value );
   }
@@ -144,6 +152,41 @@ string atomObj::getVersion() const {
   }
 }
 
+time_t atomObj::parseTime( const string &value ) {
+  if ( value.empty() ) return 0;
+  if ( value.find_first_not_of( "0123456789" ) == string::npos ) return (time_t) ( strtoll( value.c_str(), NULL, 10 ) / 1000 );
+  struct tm tm;
+  int offH = 0, offM = 0;
+  char sign = 'Z';
+  if ( sscanf( value.c_str(), "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec ) != 6 ) return 0;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = 0;
+  // The (optional) fraction of seconds is followed by Z or the UTC offset
+  string::size_type zone = value.find_first_of( "Z+-", 19 );
+  if ( zone != string::npos && value[zone] != 'Z' && sscanf( value.c_str() + zone + 1, "%d:%d", &offH, &offM ) == 2 ) sign = value[zone];
+  time_t t = timegm( &tm );
+  if ( sign == '+' ) t -= offH*3600 + offM*60;
+  else if ( sign == '-' ) t += offH*3600 + offM*60;
+  return t;
+}
+
+string atomObj::formatTime( time_t t ) {
+  struct tm tm;
+  char buf[32];
+  gmtime_r( &t, &tm );
+  strftime( buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm );
+  return buf;
+}
+
+time_t atomObj::getTime( const string &elementName ) const {
+  try {
+    return parseTime( xml->FirstChildElement()->FirstChildElement( elementName )->GetText( false ) );
+  } catch ( ticpp::Exception &ex ) {
+    return 0;
+  }
+}
+
 string atomObj::getAttr( const string &attrName ) const {
   if ( attrName == "SelfURL" ) return selfURL;
   if ( attrName == "EditURL" ) return editURL;
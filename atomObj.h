@@ -14,6 +14,8 @@
  *CHANGES:
  ***************************************************************/
 
+#include <time.h>
+
 #include <string>
 #include <list>
 #include <boost/shared_ptr.hpp>
@@ -32,6 +34,7 @@ class atomObj {
 		gAPI *api;
 		ticppDocumentPtr xml;
 		std::string selfURL, editURL, altURL;
+		bool partial; // only some of the fields were requested (see atomFeed::streamEntries)
 		void extractURLs();
 		void extractURLs( const ticpp::Element *root );
 
@@ -65,6 +68,14 @@ class atomObj {
 		std::string getSelfURL() const;
 		std::string getVersion() const;
 
+		/* The value of a timestamp element (e.g. "updated", "published" or
+		 * "gphoto:timestamp"), 0 if it is missing or cannot be parsed */
+		time_t getTime( const std::string &elementName ) const;
+		// Parses RFC 3339 dates as well as milliseconds since the epoch
+		static time_t parseTime( const std::string &value );
+		// Formats t as an RFC 3339 date in UTC (as used in queries, e.g. updated-min)
+		static std::string formatTime( time_t t );
+
 		std::string getAttr( const std::string &attrName ) const;
 		std::list<std::string> listAttr() const;
 
@@ -74,6 +85,10 @@ class atomObj {
 		void setAuthor( const std::string &Author);
 		void setTitle( const std::string &Author);
 
+		// True if the object was loaded from a partial response and lacks some elements
+		bool isPartial() const { return partial; };
+		void setPartial( bool p ) { partial = p; };
+
 		virtual bool operator<(const atomObj &a) const;
 
 		friend class picasaPhoto;
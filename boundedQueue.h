@@ -0,0 +1,81 @@
+#ifndef _boundedQueue_H
+#define _boundedQueue_H
+
+/***************************************************************
+ * boundedQueue.h
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description: A FIFO queue of limited capacity shared between
+ *              threads. Producers block while it is full, consumers
+ *              while it is empty, which keeps the amount of work in
+ *              flight (and the memory it needs) bounded.
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include <list>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/utility.hpp>
+
+template<class T>
+class boundedQueue : boost::noncopyable {
+	private:
+		std::list<T> items;
+		size_t capacity;
+		bool closed;
+		mutable boost::mutex queue_mutex;
+		boost::condition_variable not_empty, not_full;
+
+	public:
+		boundedQueue( size_t cap ): capacity( cap > 0 ? cap : 1 ), closed( false ) {};
+
+		/* Blocks while the queue is full. Returns false (without
+		 * queueing item) if the queue was closed. Interruptible. */
+		bool push( const T &item ) {
+		  boost::mutex::scoped_lock l(queue_mutex);
+		  while( items.size() >= capacity && ! closed ) not_full.wait( l );
+		  if ( closed ) return false;
+		  items.push_back( item );
+		  not_empty.notify_one();
+		  return true;
+		}
+
+		/* Blocks while the queue is empty. Returns false if the queue
+		 * was closed and nothing is left in it. Interruptible. */
+		bool pop( T &item ) {
+		  boost::mutex::scoped_lock l(queue_mutex);
+		  while( items.empty() && ! closed ) not_empty.wait( l );
+		  if ( items.empty() ) return false;
+		  item = items.front();
+		  items.pop_front();
+		  not_full.notify_one();
+		  return true;
+		}
+
+		/* Wakes up all waiting threads, further pushes fail */
+		void close() {
+		  boost::mutex::scoped_lock l(queue_mutex);
+		  closed = true;
+		  not_empty.notify_all();
+		  not_full.notify_all();
+		}
+
+		size_t size() const {
+		  boost::mutex::scoped_lock l(queue_mutex);
+		  return items.size();
+		}
+
+		std::list<T> contents() const {
+		  boost::mutex::scoped_lock l(queue_mutex);
+		  return items;
+		}
+};
+
+
+#endif /* _boundedQueue_H */
@@ -0,0 +1,45 @@
+/***************************************************************
+ * bufferPool.cpp
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description:
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include "bufferPool.h"
+
+using namespace std;
+
+boost::mutex bufferPool::pool_mutex;
+vector<string *> bufferPool::pool;
+const size_t bufferPool::maxPooled = 16;
+const size_t bufferPool::maxPooledCapacity = 16*1024*1024;
+int bufferPool::allocated_count = 0;
+
+string *bufferPool::acquire() {
+  boost::mutex::scoped_lock l(pool_mutex);
+  if ( pool.empty() ) {
+    allocated_count++;
+    return new string();
+  }
+  string *ret = pool.back();
+  pool.pop_back();
+  return ret;
+}
+
+void bufferPool::release( string *buf ) {
+  if ( ! buf ) return;
+  buf->clear(); // keeps the capacity
+  boost::mutex::scoped_lock l(pool_mutex);
+  if ( pool.size() >= maxPooled || buf->capacity() > maxPooledCapacity ) {
+    l.unlock();
+    delete buf;
+    return;
+  }
+  pool.push_back( buf );
+}
@@ -0,0 +1,53 @@
+#ifndef _bufferPool_H
+#define _bufferPool_H
+
+/***************************************************************
+ * bufferPool.h
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description: A pool of string buffers for response bodies. Buffers
+ *              keep their capacity when they are returned, so fetching
+ *              a feed of a similar size as before does not allocate.
+ * Usage:       pooledBuffer buf; api->GET( URL, buf.str() );
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+
+class bufferPool {
+	private:
+		static boost::mutex pool_mutex;
+		static std::vector<std::string *> pool;
+		static const size_t maxPooled;       // number of idle buffers kept
+		static const size_t maxPooledCapacity; // larger buffers are freed instead of pooled
+
+	public:
+		static int allocated_count; // buffers which had to be newly allocated
+
+		static std::string *acquire();
+		static void release( std::string *buf );
+};
+
+/* Holds a buffer from the pool for the lifetime of the object */
+class pooledBuffer : private boost::noncopyable {
+	private:
+		std::string *buf;
+
+	public:
+		pooledBuffer(): buf( bufferPool::acquire() ) {};
+		~pooledBuffer() { bufferPool::release( buf ); };
+
+		std::string &str() { return *buf; };
+		const std::string &str() const { return *buf; };
+};
+
+
+#endif /* _bufferPool_H */
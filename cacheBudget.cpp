@@ -0,0 +1,125 @@
+/***************************************************************
+ * cacheBudget.cpp
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description:
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include "cacheBudget.h"
+
+#include <iostream>
+
+using namespace std;
+
+cacheBudget::cacheBudget( unsigned long long budgetBytes ):
+	budget( budgetBytes ), usage( 0 ), a1inBytes( 0 )
+{
+}
+
+void cacheBudget::setBudget( unsigned long long budgetBytes ) {
+  boost::mutex::scoped_lock l(budget_mutex);
+  budget = budgetBytes;
+}
+
+// WARNING: Need to acquire a lock on budget_mutex before calling this function.
+void cacheBudget::rememberGhost( const string &key ) {
+  a1out.push_front( key );
+  ghosts[key] = a1out.begin();
+  if ( a1out.size() > maxGhosts ) {
+    ghosts.erase( a1out.back() );
+    a1out.pop_back();
+  }
+}
+
+void cacheBudget::touch( const string &key, unsigned long long size ) {
+  boost::mutex::scoped_lock l(budget_mutex);
+  map<string, struct entry>::iterator it = entries.find( key );
+  if ( it != entries.end() ) {
+    struct entry &e = it->second;
+    usage += size - e.size;
+    if ( e.hot ) am.splice( am.begin(), am, e.pos );
+    else a1inBytes += size - e.size; // a second access while still in A1in does not promote
+    e.size = size;
+    return;
+  }
+  struct entry e;
+  e.size = size;
+  map<string, list<string>::iterator>::iterator g = ghosts.find( key );
+  if ( g != ghosts.end() ) {
+    // Requested again after it was evicted from A1in, it is worth keeping
+    a1out.erase( g->second );
+    ghosts.erase( g );
+    e.hot = true;
+    am.push_front( key );
+    e.pos = am.begin();
+  } else {
+    e.hot = false;
+    a1in.push_front( key );
+    e.pos = a1in.begin();
+    a1inBytes += size;
+  }
+  usage += size;
+  entries[key] = e;
+}
+
+void cacheBudget::remove( const string &key ) {
+  boost::mutex::scoped_lock l(budget_mutex);
+  map<string, struct entry>::iterator it = entries.find( key );
+  if ( it == entries.end() ) return;
+  usage -= it->second.size;
+  if ( it->second.hot ) am.erase( it->second.pos );
+  else {
+    a1inBytes -= it->second.size;
+    a1in.erase( it->second.pos );
+  }
+  entries.erase( it );
+}
+
+// WARNING: Need to acquire a lock on budget_mutex before calling this function.
+bool cacheBudget::evictFrom( list<string> &queue, evictablePredicate &canEvict, list<string> &victims ) {
+  for( list<string>::iterator k = queue.end(); k != queue.begin(); ) {
+    --k;
+    if ( ! canEvict( *k ) ) continue;
+    struct entry &e = entries[*k];
+    usage -= e.size;
+    if ( ! e.hot ) {
+      a1inBytes -= e.size;
+      rememberGhost( *k );
+    }
+    victims.push_back( *k );
+    entries.erase( *k );
+    queue.erase( k );
+    return true;
+  }
+  return false;
+}
+
+list<string> cacheBudget::evict( evictablePredicate canEvict ) {
+  boost::mutex::scoped_lock l(budget_mutex);
+  list<string> victims;
+  while( budget > 0 && usage > budget ) {
+    // A1in may use a quarter of the budget, beyond that it is evicted first
+    bool coldFirst = ( a1inBytes > budget / 4 || am.empty() );
+    if ( coldFirst ) {
+      if ( ! evictFrom( a1in, canEvict, victims ) && ! evictFrom( am, canEvict, victims ) ) break;
+    } else {
+      if ( ! evictFrom( am, canEvict, victims ) && ! evictFrom( a1in, canEvict, victims ) ) break;
+    }
+  }
+  return victims;
+}
+
+ostream &operator<<( ostream &out, cacheBudget &b ) {
+  boost::mutex::scoped_lock l(b.budget_mutex);
+  out << b.usage / (1024*1024) << "Mb used";
+  if ( b.budget > 0 ) out << " of " << b.budget / (1024*1024) << "Mb";
+  else out << " (no limit)";
+  out << ", " << b.a1in.size() << " files seen once, " << b.am.size() << " files in frequent use";
+  return out;
+}
@@ -0,0 +1,76 @@
+#ifndef _cacheBudget_H
+#define _cacheBudget_H
+
+/***************************************************************
+ * cacheBudget.h
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description: Keeps the size of the photo backing store within a
+ *              byte budget using the 2Q replacement policy. Files seen
+ *              for the first time enter a FIFO (A1in); only a file
+ *              requested again after it dropped out of it (tracked in
+ *              the ghost list A1out) gets into the LRU list Am. A scan
+ *              of a large album thus evicts only other once-read files.
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include <string>
+#include <list>
+#include <map>
+#include <iosfwd>
+
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+class cacheBudget {
+	public:
+		typedef boost::function<bool (const std::string &)> evictablePredicate;
+
+	private:
+		struct entry {
+			unsigned long long size;
+			bool hot; // in Am (otherwise in A1in)
+			std::list<std::string>::iterator pos;
+		};
+
+		boost::mutex budget_mutex;
+		unsigned long long budget, usage, a1inBytes;
+		std::map<std::string, struct entry> entries;
+		std::list<std::string> a1in, am; // most recently used at the front
+		std::list<std::string> a1out;
+		std::map<std::string, std::list<std::string>::iterator> ghosts;
+
+		static const size_t maxGhosts = 8192;
+
+		void rememberGhost( const std::string &key );
+		bool evictFrom( std::list<std::string> &queue, evictablePredicate &canEvict, std::list<std::string> &victims );
+
+	public:
+		cacheBudget( unsigned long long budgetBytes = 0 );
+
+		// A budget of 0 means unlimited
+		void setBudget( unsigned long long budgetBytes );
+		unsigned long long getBudget() const { return budget; };
+		unsigned long long getUsage() const { return usage; };
+		bool overBudget() const { return ( budget > 0 && usage > budget ); };
+
+		/* Records an access to (or the download of) the backing file key */
+		void touch( const std::string &key, unsigned long long size );
+		void remove( const std::string &key );
+
+		/* Chooses files to delete until the usage fits into the budget and
+		 * stops tracking them. Files for which canEvict returns false are
+		 * skipped (and stay where they are in the queues). */
+		std::list<std::string> evict( evictablePredicate canEvict );
+
+		friend std::ostream &operator<<( std::ostream &out, cacheBudget &b );
+};
+
+
+#endif /* _cacheBudget_H */
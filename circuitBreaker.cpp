@@ -0,0 +1,115 @@
+/***************************************************************
+ * circuitBreaker.cpp
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description:
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include "circuitBreaker.h"
+
+#include <iostream>
+
+using namespace std;
+
+circuitBreaker::circuitBreaker( int threshold, int minInterval, int maxInterval ):
+	st( CLOSED ), consecutiveFailures( 0 ), failureThreshold( threshold ),
+	minOpenInterval( minInterval ), maxOpenInterval( maxInterval ), openInterval( minInterval ),
+	retryAt( 0 ), probeInFlight( false )
+{
+}
+
+// WARNING: Need to acquire a lock on breaker_mutex before calling this function.
+void circuitBreaker::trip() {
+  st = OPEN;
+  probeInFlight = false;
+  retryAt = time( NULL ) + openInterval;
+  cerr << "circuitBreaker: OPEN for " << openInterval << "s after " << consecutiveFailures << " failures\n";
+}
+
+enum circuitBreaker::admission circuitBreaker::admit() {
+  boost::mutex::scoped_lock l(breaker_mutex);
+  switch( st ) {
+    case CLOSED:
+      return ADMIT;
+    case OPEN:
+      if ( time( NULL ) < retryAt ) return REJECT;
+      st = HALF_OPEN;
+      probeInFlight = true;
+      return PROBE;
+    case HALF_OPEN:
+      if ( probeInFlight ) return REJECT;
+      probeInFlight = true;
+      return PROBE;
+  }
+  return REJECT;
+}
+
+bool circuitBreaker::available() {
+  boost::mutex::scoped_lock l(breaker_mutex);
+  switch( st ) {
+    case CLOSED:
+      return true;
+    case OPEN:
+      return ( time( NULL ) >= retryAt );
+    case HALF_OPEN:
+      return ( ! probeInFlight );
+  }
+  return false;
+}
+
+void circuitBreaker::recordSuccess() {
+  boost::mutex::scoped_lock l(breaker_mutex);
+  if ( st != CLOSED ) cerr << "circuitBreaker: CLOSED, connection to the API host restored\n";
+  st = CLOSED;
+  consecutiveFailures = 0;
+  openInterval = minOpenInterval;
+  probeInFlight = false;
+}
+
+void circuitBreaker::recordFailure() {
+  boost::mutex::scoped_lock l(breaker_mutex);
+  consecutiveFailures++;
+  if ( st == HALF_OPEN ) {
+    openInterval *= 2;
+    if ( openInterval > maxOpenInterval ) openInterval = maxOpenInterval;
+    trip();
+  } else if ( st == CLOSED && consecutiveFailures >= failureThreshold ) {
+    trip();
+  }
+}
+
+void circuitBreaker::reset() {
+  boost::mutex::scoped_lock l(breaker_mutex);
+  st = CLOSED;
+  consecutiveFailures = 0;
+  openInterval = minOpenInterval;
+  probeInFlight = false;
+}
+
+enum circuitBreaker::state circuitBreaker::getState() {
+  boost::mutex::scoped_lock l(breaker_mutex);
+  return st;
+}
+
+ostream &operator<<( ostream &out, circuitBreaker &b ) {
+  boost::mutex::scoped_lock l(b.breaker_mutex);
+  switch( b.st ) {
+    case circuitBreaker::CLOSED:
+      out << "closed";
+      break;
+    case circuitBreaker::OPEN:
+      out << "open (next probe in " << b.retryAt - time( NULL ) << "s)";
+      break;
+    case circuitBreaker::HALF_OPEN:
+      out << "half-open";
+      break;
+  }
+  out << ", consecutive failures: " << b.consecutiveFailures;
+  return out;
+}
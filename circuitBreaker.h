@@ -0,0 +1,64 @@
+#ifndef _circuitBreaker_H
+#define _circuitBreaker_H
+
+/***************************************************************
+ * circuitBreaker.h
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description: Tracks the health of the connection to the API host.
+ *              After several consecutive failed requests the breaker
+ *              opens and requests fail fast. When the open interval
+ *              elapses a single caller is admitted as a probe; its
+ *              outcome either closes the breaker or reopens it with
+ *              a doubled interval.
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include <time.h>
+
+#include <iosfwd>
+
+#include <boost/thread/mutex.hpp>
+
+class circuitBreaker {
+	public:
+		enum state { CLOSED, OPEN, HALF_OPEN };
+		enum admission { ADMIT, PROBE, REJECT };
+
+	private:
+		boost::mutex breaker_mutex;
+		enum state st;
+		int consecutiveFailures, failureThreshold;
+		int minOpenInterval, maxOpenInterval, openInterval;
+		time_t retryAt;
+		bool probeInFlight;
+
+		void trip();
+
+	public:
+		circuitBreaker( int threshold = 3, int minInterval = 5, int maxInterval = 300 );
+
+		/* Decides whether a request may proceed. PROBE means the caller
+		 * was chosen to test the connection and must report the outcome
+		 * via recordSuccess() or recordFailure(). */
+		enum admission admit();
+
+		/* True if a request issued now would not be rejected. */
+		bool available();
+
+		void recordSuccess();
+		void recordFailure();
+		void reset();
+
+		enum state getState();
+
+		friend std::ostream &operator<<( std::ostream &out, circuitBreaker &b );
+};
+
+
+#endif /* _circuitBreaker_H */
@@ -87,6 +87,15 @@ void picasaConfig::loadCF() {
       else if ( key == "maxPixels" ) ss >> maxPixels;
       else if ( key == "updateInterval" ) ss >> updateInterval;
       else if ( key == "offline" ) offline = (value == "true");
+      else if ( key == "hedgeRequests" ) hedgeRequests = (value == "true");
+      else if ( key == "resizeWorkers" ) ss >> resizeWorkers;
+      else if ( key == "uploadWorkers" ) ss >> uploadWorkers;
+      else if ( key == "cacheSize" ) ss >> cacheSize;
+      else if ( key == "staleWhileRevalidate" ) staleWhileRevalidate = (value == "true");
+      else if ( key == "metadataTimeout" ) ss >> metadataTimeout;
+      else if ( key == "readTimeout" ) ss >> readTimeout;
+      else if ( key == "refreshTimeout" ) ss >> refreshTimeout;
+      else if ( key == "uploadTimeout" ) ss >> uploadTimeout;
 #ifdef HAVE_DBUS
       else if ( key == "useKeyRing" ) useKeyRing = (value != "false" );
 #endif
@@ -102,7 +111,9 @@ picasaConfig::picasaConfig(myfs_config& cf):
 #ifdef HAVE_DBUS  
   useKeyRing(true),
 #endif
-  offline(false)
+  offline(false), hedgeRequests(false), resizeWorkers(2), uploadWorkers(3), cacheSize(0),
+  staleWhileRevalidate(false),
+  metadataTimeout(15), readTimeout(60), refreshTimeout(180), uploadTimeout(0)
 {
   if ( cf.cfdir != NULL ) configDir=cf.cfdir;
   else {
@@ -117,6 +128,15 @@ picasaConfig::picasaConfig(myfs_config& cf):
   if ( cf.maxPixels > 0 ) maxPixels = cf.maxPixels;
   if ( cf.updateInterval > 0 ) updateInterval = cf.updateInterval;
   if ( cf.offline ) offline = true;
+  if ( cf.hedge ) hedgeRequests = true;
+  if ( cf.resizeWorkers > 0 ) resizeWorkers = cf.resizeWorkers;
+  if ( cf.uploadWorkers > 0 ) uploadWorkers = cf.uploadWorkers;
+  if ( cf.cacheSize > 0 ) cacheSize = cf.cacheSize;
+  if ( cf.staleOK ) staleWhileRevalidate = true;
+  if ( cf.metadataTimeout > 0 ) metadataTimeout = cf.metadataTimeout;
+  if ( cf.readTimeout > 0 ) readTimeout = cf.readTimeout;
+  if ( cf.refreshTimeout > 0 ) refreshTimeout = cf.refreshTimeout;
+  if ( cf.uploadTimeout > 0 ) uploadTimeout = cf.uploadTimeout;
 #ifdef HAVE_DBUS  
   if ( ! cf.useKeyRing ) useKeyRing = false;
 #endif
@@ -220,6 +240,13 @@ ostream &operator<<(ostream &out, const picasaConfig &conf) {
   out << " cacheDir       = " << conf.getCacheDir() << "\n";
   out << " maxPixels      = " << conf.getMaxPixels() << "\n";
   out << " updateInterval = " << conf.getUpdateInterval()<<"\n";
+  out << " hedgeRequests  = " << ( conf.getHedgeRequests() ? "true" : "false" ) << "\n";
+  out << " resizeWorkers  = " << conf.getResizeWorkers() << "\n";
+  out << " uploadWorkers  = " << conf.getUploadWorkers() << "\n";
+  out << " cacheSize      = " << conf.getCacheSize() << "\n";
+  out << " staleWhileRevalidate = " << ( conf.getStaleWhileRevalidate() ? "true" : "false" ) << "\n";
+  out << " timeouts       = " << conf.getMetadataTimeout() << "s metadata, " << conf.getReadTimeout() << "s read, "
+      << conf.getRefreshTimeout() << "s refresh, " << conf.getUploadTimeout() << "s upload (0 = none)\n";
 #ifdef HAVE_DBUS  
   out << " useKeyRing	  = ";
   if ( conf.useKeyRing ) out << "true\n";
@@ -26,6 +26,11 @@ struct myfs_config {
   char *cacheDir, *userName, *cfdir, *password;
   int updateInterval, maxPixels;
   int offline;
+  int hedge;
+  int resizeWorkers, uploadWorkers;
+  int cacheSize;
+  int staleOK;
+  int metadataTimeout, readTimeout, refreshTimeout, uploadTimeout;
   #ifdef HAVE_DBUS
   int useKeyRing;
   #endif
@@ -38,7 +43,11 @@ private:
   std::string configDir;
   std::map<std::string,std::string> cf_vals;
   int updateInterval, maxPixels;
-  bool offline;
+  bool offline, hedgeRequests;
+  int resizeWorkers, uploadWorkers;
+  int cacheSize; // Mb, 0 means unlimited
+  bool staleWhileRevalidate;
+  int metadataTimeout, readTimeout, refreshTimeout, uploadTimeout; // seconds, 0 means no limit
 
 
   void inputPassword();
@@ -66,6 +75,15 @@ public:
   int getUpdateInterval() const {return updateInterval;};
   int getMaxPixels() const {return maxPixels;};
   bool getOffline() const {return offline;};
+  bool getHedgeRequests() const {return hedgeRequests;};
+  int getResizeWorkers() const {return resizeWorkers;};
+  int getUploadWorkers() const {return uploadWorkers;};
+  int getCacheSize() const {return cacheSize;};
+  bool getStaleWhileRevalidate() const {return staleWhileRevalidate;};
+  int getMetadataTimeout() const {return metadataTimeout;};
+  int getReadTimeout() const {return readTimeout;};
+  int getRefreshTimeout() const {return refreshTimeout;};
+  int getUploadTimeout() const {return uploadTimeout;};
 
   friend std::ostream &operator<<(std::ostream &out, const picasaConfig &conf );
 
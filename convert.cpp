@@ -35,6 +35,7 @@
 
 
 #include "convert.h"
+#include "jpegHeader.h"
 
 
 using namespace std;
@@ -45,10 +46,13 @@ convert::convert():
 }
 
 string convert::getComment( const string &image ) { 
+  // For JPEGs only the header segments need to be looked at
+  jpegHeader hdr;
+  if ( hdr.load( image ) ) return hdr.getComment();
   #ifdef HAVE_MAGICK
   Magick::Image img;
   try { 
-    img.read( image );
+    img.ping( image );
     return img.attribute("comment");
   } catch ( Magick::Exception &ex ) { 
     cerr << " convert::getComment( " << image << " ): ERROR:" << ex.what() << endl;
@@ -71,11 +75,17 @@ bool convert::resize( long numOfPix, const string &fIN, const string &fOUT ) {
     uint w = sz.width(), h = sz.height();
     if ( w*h <= numOfPix ) return true;
     double factor = sqrt((double)numOfPix/(double)(w*h));
-    stringstream ss;
+    stringstream ss, hint;
     ss << floor(w*factor) << "x" << floor(h*factor) << ">";   
-    img.read( fIN );
-    img.scale( ss.str() );
-    img.write( outf );
+    hint << floor(w*factor) << "x" << floor(h*factor);
+    Magick::Image scaled;
+    /* libjpeg can decode directly at 1/2, 1/4 or 1/8 of the size; with the
+     * hint it picks the smallest of those which is still at least as large
+     * as the target, so the full resolution pixels are never allocated */
+    if ( img.magick() == "JPEG" ) scaled.defineValue( "jpeg", "size", hint.str() );
+    scaled.read( fIN );
+    scaled.scale( ss.str() );
+    scaled.write( outf );
     return true;
   } catch ( Magick::Exception &ex ) {
     cerr << " Exception while reading/resizing image: " << ex.what() << endl;
@@ -17,12 +17,142 @@
 #include <curl/curl.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <boost/thread/mutex.hpp>
 
 using namespace std;
 
 map<boost::thread::id, void*> curlRequest::curl_handles;
+boost::mutex curlRequest::curl_handles_mutex;
 int curlRequest::handles_count = 0;
+boost::mutex curlRequest::counters_mutex;
+int curlRequest::retries_count = 0;
+circuitBreaker curlRequest::breaker;
+const int curlRequest::maxRetries = 4;
+int curlRequest::hedgeable_count = 0;
+int curlRequest::hedges_count = 0;
+int curlRequest::hedge_wins_count = 0;
+bool curlRequest::hedgingEnabled = false;
+int curlRequest::timeouts_count = 0;
+int curlRequest::deadlines[curlRequest::NUM_DEADLINE_CLASSES] = { 15, 60, 180, 0 };
+boost::thread_specific_ptr<int> curlRequest::thread_class;
+volatile bool curlRequest::cancelled = false;
+
+/* A HEAD request against the API host, used to decide whether
+ * the network is back without fetching anything substantial */
+static const char *PROBE_URL = "http://picasaweb.google.com/data/";
+static const long BACKOFF_BASE_MS = 250, BACKOFF_CAP_MS = 8000;
+/* A connection which transfers less than LOW_SPEED_LIMIT bytes/s for
+ * LOW_SPEED_TIME seconds is considered hung, whatever the deadline */
+static const long CONNECT_TIMEOUT_MS = 10000, LOW_SPEED_LIMIT = 1, LOW_SPEED_TIME = 30;
+
+
+/* Keeps the time to first byte of the last few GET requests and
+ * derives the deadline after which a request is hedged from them */
+class latencyWindow {
+  private:
+    boost::mutex window_mutex;
+    std::vector<long> samples;
+    size_t next;
+    static const size_t windowSize = 128, minSamples = 16;
+    static const long defaultDeadlineMS = 2000, minDeadlineMS = 100;
+
+  public:
+    latencyWindow(): next(0) {};
+
+    void add( long ms ) {
+      boost::mutex::scoped_lock l(window_mutex);
+      if ( samples.size() < windowSize ) samples.push_back( ms );
+      else samples[next] = ms;
+      next = ( next + 1 ) % windowSize;
+    }
+
+    long p95() {
+      boost::mutex::scoped_lock l(window_mutex);
+      if ( samples.size() < minSamples ) return defaultDeadlineMS;
+      std::vector<long> s( samples );
+      l.unlock();
+      std::vector<long>::iterator pos = s.begin() + ( s.size() * 95 ) / 100;
+      std::nth_element( s.begin(), pos, s.end() );
+      return std::max( *pos, minDeadlineMS );
+    }
+};
+
+static latencyWindow firstByteLatency;
+
+
+/* Shared by the two copies of a hedged request. The first copy to
+ * deliver body data becomes the winner, the other one is aborted
+ * by refusing its data. */
+struct hedgeRace {
+  int winner;
+  string *response;
+  FILE *outfl;
+  curlRequest::streamSink *sink; // NULL unless the body is streamed
+  bool *started; // set once anything was passed to the sink
+};
+
+struct hedgeAttempt {
+  struct hedgeRace *race;
+  int id;
+  void *curl;
+  map<string,string> headers; // of this copy only, the winner's are kept
+  string errorBody; // the body of a non 2xx response
+};
+
+/* Only a copy which gets a 2xx response can win the race, the body of
+ * an error response is kept aside in case no copy gets a good one */
+static size_t hedgedData(void *ptr, size_t size, size_t nmemb, void *data ) {
+  struct hedgeAttempt *attempt = static_cast<struct hedgeAttempt *>(data);
+  struct hedgeRace *race = attempt->race;
+  if ( race->winner == -1 ) {
+    long code = -1;
+    curl_easy_getinfo( attempt->curl, CURLINFO_RESPONSE_CODE, &code );
+    if ( code < 200 || code >= 300 ) {
+      attempt->errorBody.append( (char *) ptr, size*nmemb );
+      return size*nmemb;
+    }
+    race->winner = attempt->id;
+    map<string,string>::iterator len = attempt->headers.find( "content-length" );
+    if ( ! race->outfl && ! race->sink && len != attempt->headers.end() ) {
+      unsigned long long bodySize = strtoull( len->second.c_str(), NULL, 10 );
+      if ( bodySize > 0 && bodySize < 256*1024*1024 ) race->response->reserve( bodySize );
+    }
+  }
+  if ( race->winner != attempt->id ) return 0;
+  if ( race->outfl ) return fwrite( ptr, size, nmemb, race->outfl ) * size;
+  if ( race->sink ) {
+    // Only the winner streams, so the sink sees a single copy of the body
+    *race->started = true;
+    try {
+      (*race->sink)( (const char *) ptr, size*nmemb );
+    } catch ( ... ) {
+      cerr << "curlRequest: error while processing the response, aborting the transfer\n";
+      return 0;
+    }
+    return size*nmemb;
+  }
+  race->response->append( (char *) ptr, size*nmemb );
+  return size*nmemb;
+}
+
+static long elapsedMS( const struct timeval &start ) {
+  struct timeval now;
+  gettimeofday( &now, NULL );
+  return ( now.tv_sec - start.tv_sec ) * 1000 + ( now.tv_usec - start.tv_usec ) / 1000;
+}
 
 
 static size_t responseData(void *ptr, size_t size, size_t nmemb, void *data ) {
@@ -31,38 +161,199 @@ static size_t responseData(void *ptr, size_t size, size_t nmemb, void *data ) {
   return size*nmemb;
 }
 
-struct requestData {
-  string data;
-  size_t size,pos;
+struct streamTarget {
+  curlRequest::streamSink *sink;
+  string *response; // where error responses go
+  void *curl;
+  int mode; // -1 before the first data arrive, 1 if streaming, 0 if collecting
+  bool failed;
+  bool *started; // set once anything was passed to the sink
+};
+
+/* Streams the body of a 2xx response, anything else is collected like
+ * usual so that it can be reported. Exceptions thrown by the sink must not
+ * travel through curl, they abort the transfer instead. */
+static size_t streamedData(void *ptr, size_t size, size_t nmemb, void *data ) {
+  struct streamTarget *t = static_cast<struct streamTarget *>(data);
+  size_t len = size*nmemb;
+  if ( t->mode < 0 ) {
+    long code = -1;
+    curl_easy_getinfo( t->curl, CURLINFO_RESPONSE_CODE, &code );
+    t->mode = ( code >= 200 && code < 300 ) ? 1 : 0;
+  }
+  if ( t->mode == 0 || len == 0 ) {
+    t->response->append( (char *) ptr, len );
+    return len;
+  }
+  *t->started = true;
+  try {
+    (*t->sink)( (const char *) ptr, len );
+  } catch ( ... ) {
+    cerr << "curlRequest: error while processing the response, aborting the transfer\n";
+    t->failed = true;
+    return 0;
+  }
+  return len;
+}
+
+struct responseSink {
+  string *body;
+  map<string,string> *headers;
+};
+
+/* Collects the response headers and reserves the response buffer as soon
+ * as we know how large the body is, so that appending to it does not reallocate */
+static size_t responseHeader(void *ptr, size_t size, size_t nmemb, void *data ) {
+  struct responseSink *sink = static_cast<struct responseSink *>(data);
+  const char *hdr = (const char *) ptr;
+  size_t len = size*nmemb;
+  const char *colon = (const char *) memchr( hdr, ':', len );
+  if ( colon == NULL ) return len;
+  string name( hdr, colon - hdr ), value( colon + 1, len - ( colon + 1 - hdr ) );
+  for( string::iterator c = name.begin(); c != name.end(); c++ ) *c = tolower( *c );
+  string::size_type b = value.find_first_not_of( " \t" ), e = value.find_last_not_of( " \t\r\n" );
+  value = ( b == string::npos ) ? "" : value.substr( b, e - b + 1 );
+  (*sink->headers)[name] = value;
+  if ( name == "content-length" && sink->body ) {
+    unsigned long long bodySize = strtoull( value.c_str(), NULL, 10 );
+    if ( bodySize > 0 && bodySize < 256*1024*1024 ) sink->body->reserve( sink->body->size() + bodySize );
+  }
+  return len;
+}
+
+/* The parts of an upload body in the order they are sent. Only the
+ * short part headers are built, the atom entry is read from where it
+ * already is and the file with pread. The file is not mapped: it is the
+ * live backing file, which may be truncated while it is being sent. */
+struct uploadBody {
+  static const int MAX_SEGMENTS = 5;
+  const char *data[MAX_SEGMENTS];
+  int fd[MAX_SEGMENTS]; // -1 for segments in memory
+  off_t offset[MAX_SEGMENTS];
+  size_t len[MAX_SEGMENTS];
+  int count, current;
+  size_t pos;
+  bool truncated;
+
+  uploadBody(): count(0), current(0), pos(0), truncated(false) {};
+  void add( const char *d, size_t l ) { if ( l == 0 ) return; data[count] = d; fd[count] = -1; offset[count] = 0; len[count] = l; count++; };
+  void addFile( int f, off_t off, size_t l ) { if ( l == 0 ) return; data[count] = NULL; fd[count] = f; offset[count] = off; len[count] = l; count++; };
+  curl_off_t size() const {
+    curl_off_t total = 0;
+    for( int i = 0; i < count; i++ ) total += len[i];
+    return total;
+  }
+};
+
+static size_t uploadData(void *ptr, size_t size, size_t nmemb, void *data ) {
+  struct uploadBody *ub = static_cast<struct uploadBody *>(data);
+  size_t room = size*nmemb, written = 0;
+  while( room > 0 && ub->current < ub->count ) {
+    int c = ub->current;
+    size_t n = std::min( room, ub->len[c] - ub->pos );
+    if ( ub->fd[c] < 0 ) memcpy( (char *) ptr + written, ub->data[c] + ub->pos, n );
+    else {
+      ssize_t r;
+      do {
+	r = pread( ub->fd[c], (char *) ptr + written, n, ub->offset[c] + ub->pos );
+      } while ( r < 0 && errno == EINTR );
+      // The file got shorter than announced, the request can not be completed
+      if ( r <= 0 ) {
+	ub->truncated = true;
+	return CURL_READFUNC_ABORT;
+      }
+      n = r;
+    }
+    written += n;
+    room -= n;
+    ub->pos += n;
+    if ( ub->pos == ub->len[c] ) {
+      ub->current++;
+      ub->pos = 0;
+    }
+  }
+  return written;
+}
+
+// Lets curl rewind the body (e.g. to resend it after a redirect)
+static int uploadSeek( void *data, curl_off_t offset, int origin ) {
+  struct uploadBody *ub = static_cast<struct uploadBody *>(data);
+  if ( origin != SEEK_SET ) return CURL_SEEKFUNC_CANTSEEK;
+  ub->current = 0;
+  while( ub->current < ub->count && offset >= (curl_off_t) ub->len[ub->current] ) {
+    offset -= ub->len[ub->current];
+    ub->current++;
+  }
+  if ( ub->current == ub->count && offset > 0 ) return CURL_SEEKFUNC_FAIL;
+  ub->pos = offset;
+  return CURL_SEEKFUNC_OK;
+}
+
+// Closes the file being uploaded on every way out of performOnce
+struct uploadFile {
+  int fd;
+  off_t size;
+  uploadFile(): fd(-1), size(0) {};
+  ~uploadFile() { if ( fd >= 0 ) ::close( fd ); };
 };
 
-static size_t requestData(void *ptr, size_t size, size_t nmemb, void *Data ) {
-  struct requestData *data = (struct requestData *) Data;
-  size_t availableData = data->size-data->pos, bufSize = size*nmemb, copySize;
-  if ( availableData > bufSize ) copySize = bufSize;
-  else copySize = availableData;
-/*  cerr<<"requestData(...,"<<size<<","<<nmemb<<",...)\n";
-  cerr<<"  availableData:"<<availableData<<"\n";
-  cerr<<"  copySize:"<<copySize<<"\n";
-  cerr<<"  pos:"<<data->pos<<"\n";
-  cerr<<"  totalDataSize:"<<data->size<<"\n"; */
-  data->data.copy( (char *) ptr, copySize, data->pos );
-  data->pos+=copySize;
-  return copySize;
+static bool openUpload( const string &fname, struct uploadFile &f ) {
+  struct stat st;
+  f.fd = open( fname.c_str(), O_RDONLY );
+  if ( f.fd < 0 || fstat( f.fd, &st ) != 0 ) {
+    cerr << "curlRequest::perform(): cannot open file '"<<fname<<"' for reading.";
+    return false;
+  }
+  f.size = st.st_size;
+  return true;
 }
 
 
 
 
+
 curlRequest::curlRequest():
-	request( GET ), body(""), URL(""), status(-1),
-	response(""), outFile(""),network_down(false)
+	request( GET ), URL(""), body(""), outFile(""), bodyRef(&body), inOffset(0), inLength(-1),
+	status(-1), network_down(false), hedged(false), attempt_timeout(0), deadline_hit(false), stream_started(false),
+	endpoint( httpStats::NUM_CLASSES )
 {
 }
 
+curlRequest::deadlineScope::deadlineScope( enum deadlineClass cls ) {
+  previous = currentClass();
+  if ( thread_class.get() == NULL ) thread_class.reset( new int );
+  *thread_class = cls;
+}
+
+curlRequest::deadlineScope::~deadlineScope() {
+  *thread_class = previous;
+}
+
+enum curlRequest::deadlineClass curlRequest::currentClass() {
+  if ( thread_class.get() == NULL ) return BACKGROUND;
+  return (enum deadlineClass) *thread_class;
+}
+
+const char *curlRequest::deadlineClassName( enum deadlineClass cls ) {
+  switch( cls ) {
+    case FOREGROUND_METADATA: return "foreground metadata";
+    case FOREGROUND_READ: return "foreground read";
+    case BACKGROUND: return "background refresh";
+    case UPLOAD: return "upload";
+    default: return "?";
+  }
+}
+
+/* Lets curl abort the transfer after cancelAll() */
+static int checkCancelled( void *cancelled, curl_off_t, curl_off_t, curl_off_t, curl_off_t ) {
+  return ( *(volatile bool *) cancelled ) ? 1 : 0;
+}
+
 void *curlRequest::getThreadCurlHandle() {
   void *ret;
   boost::thread::id tID = boost::this_thread::get_id();
+  // Several upload workers may create their handles at the same time
+  boost::mutex::scoped_lock l(curl_handles_mutex);
   if ( curl_handles.find( tID ) == curl_handles.end() ) {
     ret = curl_easy_init();
     curl_easy_setopt(ret, CURLOPT_NOSIGNAL, 1);
@@ -75,129 +366,460 @@ void *curlRequest::getThreadCurlHandle() {
   }
 }
 
-bool curlRequest::checkNetworkConnection() {
-  cerr << "networkUP(): CHECKING NETWORK CONNECTION \n";
-  string temp;
+void curlRequest::releaseThreadHandle() {
+  boost::mutex::scoped_lock l(curl_handles_mutex);
+  map<boost::thread::id,void*>::iterator h = curl_handles.find( boost::this_thread::get_id() );
+  if ( h == curl_handles.end() ) return;
+  curl_easy_cleanup( h->second );
+  curl_handles.erase( h );
+  handles_count--;
+}
+
+void curlRequest::setMultipart( const string &atomXML, const string &fileName, const string &mediaTp ) {
+  char rnd[32];
+  snprintf( rnd, sizeof(rnd), "%08lx%08lx", random(), random() );
+  boundary = string("END_OF_PART_") + rnd;
+  bodyRef = &atomXML;
+  inFile = fileName;
+  mediaType = mediaTp;
+  headers.push_back( "Content-Type: multipart/related; boundary=\"" + boundary + "\"" );
+  headers.push_back( "MIME-version: 1.0" );
+}
+
+string curlRequest::getResponseHeader( const string &name ) const {
+  string key( name );
+  for( string::iterator c = key.begin(); c != key.end(); c++ ) *c = tolower( *c );
+  map<string,string>::const_iterator it = responseHeaders.find( key );
+  if ( it == responseHeaders.end() ) return "";
+  return it->second;
+}
+
+bool curlRequest::probe() {
   void *curl = getThreadCurlHandle();
+  if ( ! curl ) return false;
   curl_easy_reset( curl );
-  curl_easy_setopt( curl, CURLOPT_URL, "http://www.google.com" );
-  curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, responseData );
-  curl_easy_setopt( curl, CURLOPT_WRITEDATA, &temp );
+  curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1 );
+  curl_easy_setopt( curl, CURLOPT_URL, PROBE_URL );
+  curl_easy_setopt( curl, CURLOPT_NOBODY, 1 );
+  curl_easy_setopt( curl, CURLOPT_CONNECTTIMEOUT, 5 );
+  curl_easy_setopt( curl, CURLOPT_TIMEOUT, 10 );
   CURLcode cd = curl_easy_perform(curl);
   if ( cd ) {
-    cerr << "networkUP(): NO NETWORK CONNECTION (" << cd <<")\n";
-    network_down = true;
-  } else {
-    cerr << "networkUP(): FOUND NETWORK CONNECTION (" << cd <<")\n";
+    cerr << "curlRequest::probe(): API host unreachable (" << cd <<")\n";
+    return false;
+  }
+  return true;
+}
+
+bool curlRequest::checkNetworkConnection() {
+  cerr << "networkUP(): CHECKING NETWORK CONNECTION \n";
+  if ( probe() ) {
+    cerr << "networkUP(): FOUND NETWORK CONNECTION\n";
+    breaker.recordSuccess();
     network_down = false;
+  } else {
+    cerr << "networkUP(): NO NETWORK CONNECTION\n";
+    breaker.recordFailure();
+    network_down = true;
   }
   return (! network_down);
 }
 
+bool curlRequest::isNetworkError( int code ) {
+  switch ( code ) {
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+      return true;
+  }
+  return false;
+}
+
+/* Errors which happen before anything was sent, so the request
+ * can be repeated even if it is not idempotent */
+bool curlRequest::isConnectError( int code ) {
+  return ( code == CURLE_COULDNT_CONNECT || code == CURLE_COULDNT_RESOLVE_HOST );
+}
+
+/* Sleeps between BACKOFF_BASE_MS*2^attempt/2 and BACKOFF_BASE_MS*2^attempt
+ * milliseconds (capped), so that threads failing together do not retry
+ * in lockstep */
+void curlRequest::backoff( int attempt ) {
+  long delay = BACKOFF_BASE_MS << attempt;
+  if ( delay > BACKOFF_CAP_MS || delay <= 0 ) delay = BACKOFF_CAP_MS;
+  delay = delay/2 + random() % ( delay/2 + 1 );
+  // The workers are woken up by interrupts, which must not abort the wait
+  boost::this_thread::disable_interruption di;
+  boost::this_thread::sleep( boost::posix_time::milliseconds( delay ) );
+}
+
 bool curlRequest::perform() throw (enum exceptionType) {
+  if ( cancelled ) throw NO_NETWORK_CONNECTION;
+  switch( breaker.admit() ) {
+    case circuitBreaker::REJECT:
+      cerr << "curlRequest::perform(): API host unreachable, not performing request for " << URL << endl;
+      network_down = true;
+      throw NO_NETWORK_CONNECTION;
+    case circuitBreaker::PROBE:
+      if ( ! probe() ) {
+	breaker.recordFailure();
+	network_down = true;
+	throw NO_NETWORK_CONNECTION;
+      }
+      breaker.recordSuccess();
+      break;
+    case circuitBreaker::ADMIT:
+      break;
+  }
+
+  int cd;
+  bool retry;
+  long deadlineMS = 1000L * deadlines[currentClass()], left = 0;
+  struct timeval start;
+  gettimeofday( &start, NULL );
+  for( int attempt = 0; ; attempt++ ) {
+    response.str().clear();
+    status = -1;
+    if ( stream ) stream( NULL, 0 );
+    if ( deadlineMS > 0 ) left = max( deadlineMS - elapsedMS( start ), 1L );
+    cd = performOnce( left );
+    if ( cd < 0 ) return false;
+    if ( cd == CURLE_OPERATION_TIMEDOUT ) count( timeouts_count );
+    if ( cd != CURLE_OK ) retry = isConnectError( cd ) || ( isNetworkError( cd ) && idempotent() );
+    else retry = idempotent() && ( status == 502 || status == 503 || status == 504 );
+    if ( cancelled ) retry = false;
+    // What the sink got cannot be taken back, repeating it would deliver it twice
+    if ( stream_started ) retry = false;
+    // Retrying makes no sense if the deadline passes during the backoff
+    if ( deadlineMS > 0 && elapsedMS( start ) + ( BACKOFF_BASE_MS << attempt ) >= deadlineMS ) retry = false;
+    if ( ! retry || attempt >= maxRetries ) break;
+    cerr << "curlRequest::perform(): retrying request for " << URL << " (attempt " << attempt+1 << ")\n";
+    count( retries_count );
+    backoff( attempt );
+  }
+
+  if ( isNetworkError( cd ) ) {
+    // Running out of our own time says nothing about the host
+    if ( ! deadline_hit ) {
+      breaker.recordFailure();
+      network_down = true;
+    }
+    throw NO_NETWORK_CONNECTION;
+  }
+  breaker.recordSuccess();
+  network_down = false;
+  return ( cd == CURLE_OK );
+}
+
+/* Performs a single attempt of the request, giving up after timeoutMS
+ * (if positive). Returns the curl error code or -1 if the request could
+ * not even be set up. */
+int curlRequest::performOnce( long timeoutMS ) {
   cerr<<"Performing request for " << URL << endl;
+  attempt_timeout = timeoutMS;
+  deadline_hit = false;
+  stream_started = false;
   void *curl = getThreadCurlHandle();
-  if ( ! getThreadCurlHandle() ) {
+  if ( ! curl ) {
     cerr << "getFeed() Error: INVALID CURL HANDLE\n";
-    return false;
+    return -1;
   }
   curl_easy_reset( curl );
-  FILE *outfl = NULL, *infl=NULL;
+  curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1 );
+  FILE *outfl = NULL;
+  struct uploadFile upload;
+  struct uploadBody ub;
+  string atomHead, mediaHead, tail;
+  struct responseSink sink;
+  struct streamTarget target;
+  target.sink = &stream;
+  target.response = &response.str();
+  target.curl = curl;
+  target.mode = -1;
+  target.failed = false;
+  target.started = &stream_started;
+  // A streamed body is not collected, so no room is reserved for it
+  sink.body = stream ? NULL : &response.str();
+  sink.headers = &responseHeaders;
+  responseHeaders.clear();
 
   struct curl_slist *curlHDRS = NULL;
   for( list<string>::iterator hdr = headers.begin(); hdr != headers.end(); hdr++ ) {
     curlHDRS = curl_slist_append( curlHDRS, hdr->c_str() );
   }
-  if ( inFile.compare("") != 0 )
-    curlHDRS = curl_slist_append( curlHDRS, "Transfer-Encoding: chunked");
+  if ( authorization != "" ) curlHDRS = curl_slist_append( curlHDRS, ( "Authorization: " + authorization ).c_str() );
 
   curl_easy_setopt( curl, CURLOPT_URL, URL.c_str() );
   curl_easy_setopt( curl, CURLOPT_HTTPHEADER, curlHDRS );
 
-  if ( outFile.compare("") == 0 ) {
+  // Set before a hedged request duplicates the handle, so both copies get them
+  curl_easy_setopt( curl, CURLOPT_CONNECTTIMEOUT_MS, ( timeoutMS > 0 && timeoutMS < CONNECT_TIMEOUT_MS ) ? timeoutMS : CONNECT_TIMEOUT_MS );
+  if ( timeoutMS > 0 ) curl_easy_setopt( curl, CURLOPT_TIMEOUT_MS, timeoutMS );
+  curl_easy_setopt( curl, CURLOPT_LOW_SPEED_LIMIT, LOW_SPEED_LIMIT );
+  curl_easy_setopt( curl, CURLOPT_LOW_SPEED_TIME, LOW_SPEED_TIME );
+  curl_easy_setopt( curl, CURLOPT_NOPROGRESS, 0L );
+  curl_easy_setopt( curl, CURLOPT_XFERINFOFUNCTION, checkCancelled );
+  curl_easy_setopt( curl, CURLOPT_XFERINFODATA, &cancelled );
+
+  if ( outFile.compare("") == 0 && stream ) {
+    curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, streamedData );
+    curl_easy_setopt( curl, CURLOPT_WRITEDATA, &target );
+    curl_easy_setopt( curl, CURLOPT_HEADERFUNCTION, responseHeader );
+    curl_easy_setopt( curl, CURLOPT_HEADERDATA, &sink );
+  } else if ( outFile.compare("") == 0 ) {
     curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, responseData );
-    curl_easy_setopt( curl, CURLOPT_WRITEDATA, &response );
+    curl_easy_setopt( curl, CURLOPT_WRITEDATA, &response.str() );
+    curl_easy_setopt( curl, CURLOPT_HEADERFUNCTION, responseHeader );
+    curl_easy_setopt( curl, CURLOPT_HEADERDATA, &sink );
   } else {
     outfl = fopen( outFile.c_str(), "w" );
     if ( outfl == NULL ) {
       cerr << "curlRequest::perform(): cannot open file '"<<outFile<<"' for writing.";
-      return false;
+      curl_slist_free_all( curlHDRS );
+      return -1;
     }
     curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, NULL );
     curl_easy_setopt( curl, CURLOPT_WRITEDATA, outfl );
   }
 
-  struct requestData bodyData;
-  bodyData.data = body;
-  bodyData.size = body.size();
-  bodyData.pos=0;
   string method="DELETE";
 
 
+  // A streamed body only goes to the sink from the copy which won the race
+  if ( request == GET && hedged && hedgingEnabled ) {
+    int cd = performHedged( curl, outfl );
+    if ( outfl ) fclose( outfl );
+    curl_slist_free_all( curlHDRS );
+    return cd;
+  }
+
   switch( request ) {
 	  case GET:
 		  curl_easy_setopt( curl, CURLOPT_HTTPGET, 1 );
 		  break;
 	  case POST:
-		  curl_easy_setopt( curl, CURLOPT_POST, 1 );
+	  case PUT:
+		  method = ( request == POST ) ? "POST" : "PUT";
 		  if ( inFile.compare("") == 0 ) {
-		    curl_easy_setopt( curl, CURLOPT_POSTFIELDSIZE, body.size() );
-		    curl_easy_setopt( curl, CURLOPT_POSTFIELDS, body.c_str() );
+		    /* The body is handed to curl as is, with an explicit length,
+		     * so it is neither copied nor chunked */
+		    curl_easy_setopt( curl, CURLOPT_POST, 1 );
+		    curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, method.c_str() );
+		    curl_easy_setopt( curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) bodyRef->size() );
+		    curl_easy_setopt( curl, CURLOPT_POSTFIELDS, bodyRef->data() );
+		    break;
 		  } else {
-		    infl = fopen( inFile.c_str(), "r" );
-		    if ( infl == NULL ) {
-		      cerr << "curlRequest::perform(): cannot open file '"<<inFile<<"' for reading.";
-		      return false;
+		    if ( ! openUpload( inFile, upload ) ) {
+		      if ( outfl ) fclose( outfl );
+		      curl_slist_free_all( curlHDRS );
+		      return -1;
 		    }
-		    method = "POST";
-		    curl_easy_setopt( curl, CURLOPT_UPLOAD, 1 );
-		    curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, method.c_str() );
-		    curl_easy_setopt( curl, CURLOPT_READFUNCTION, NULL );
-		    curl_easy_setopt( curl, CURLOPT_READDATA, infl );
+		    off_t len = ( inLength < 0 ) ? upload.size - inOffset : inLength;
+		    if ( inOffset < 0 || len < 0 || inOffset + len > upload.size ) {
+		      cerr << "curlRequest::perform(): range " << inOffset << "+" << len << " outside of '"<<inFile<<"'.";
+		      if ( outfl ) fclose( outfl );
+		      curl_slist_free_all( curlHDRS );
+		      return -1;
+		    }
+		    ub.addFile( upload.fd, inOffset, len );
 		  }
-		  break;
-	  case PUT:
-		  method = "PUT";
-		  //curl_easy_setopt( curl, CURLOPT_PUT, 1 );
-		  curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, method.c_str() );
-		  curl_easy_setopt( curl, CURLOPT_READFUNCTION, requestData );
-		  curl_easy_setopt( curl, CURLOPT_READDATA, &bodyData );
 		  curl_easy_setopt( curl, CURLOPT_UPLOAD, 1 );
-		  curl_easy_setopt( curl, CURLOPT_INFILESIZE, body.size() );
+		  curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, method.c_str() );
+		  curl_easy_setopt( curl, CURLOPT_READFUNCTION, uploadData );
+		  curl_easy_setopt( curl, CURLOPT_READDATA, &ub );
+		  curl_easy_setopt( curl, CURLOPT_SEEKFUNCTION, uploadSeek );
+		  curl_easy_setopt( curl, CURLOPT_SEEKDATA, &ub );
+		  curl_easy_setopt( curl, CURLOPT_INFILESIZE_LARGE, ub.size() );
 		  break;
 	  case DELETE:
 		  curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, method.c_str() );
 		  break;
 	  case MULTIPART_POST:
-		  cerr << "MULTIPART POST NOT IMPLEMENTED YET";
-		  if ( outfl ) fclose( outfl );
-		  if ( infl ) fclose( infl );
-		  curl_slist_free_all( curlHDRS );
-		  return false;
+	  case MULTIPART_PUT:
+		  /* Streamed from the atom entry and the file with an explicit
+		   * Content-Length (the API does not accept chunked bodies) */
+		  method = ( request == MULTIPART_POST ) ? "POST" : "PUT";
+		  if ( ! openUpload( inFile, upload ) ) {
+		    if ( outfl ) fclose( outfl );
+		    curl_slist_free_all( curlHDRS );
+		    return -1;
+		  }
+		  atomHead = "Media multipart posting\r\n--" + boundary + "\r\nContent-Type: application/atom+xml\r\n\r\n";
+		  mediaHead = "\r\n--" + boundary + "\r\nContent-Type: " + mediaType + "\r\n\r\n";
+		  tail = "\r\n--" + boundary + "--\r\n";
+		  ub.add( atomHead.data(), atomHead.size() );
+		  ub.add( bodyRef->data(), bodyRef->size() );
+		  ub.add( mediaHead.data(), mediaHead.size() );
+		  ub.addFile( upload.fd, 0, upload.size );
+		  ub.add( tail.data(), tail.size() );
+		  curl_easy_setopt( curl, CURLOPT_UPLOAD, 1 );
+		  curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, method.c_str() );
+		  curl_easy_setopt( curl, CURLOPT_READFUNCTION, uploadData );
+		  curl_easy_setopt( curl, CURLOPT_READDATA, &ub );
+		  curl_easy_setopt( curl, CURLOPT_SEEKFUNCTION, uploadSeek );
+		  curl_easy_setopt( curl, CURLOPT_SEEKDATA, &ub );
+		  curl_easy_setopt( curl, CURLOPT_INFILESIZE_LARGE, ub.size() );
+		  break;
   }
   CURLcode cd = curl_easy_perform(curl);
   cerr<<"DONE Performing request for " << URL <<endl;
+  recordTiming( curl, cd, attempt_timeout );
   if ( cd ) {
-      if ( outfl ) fclose( outfl );
-      if ( infl ) fclose( infl );
-      curl_slist_free_all( curlHDRS );
-      cerr << "getFeed() Error: CURL ERROR IN OPERATION(" <<cd <<") \n";
-      switch ( cd ) {
-	case CURLE_COULDNT_CONNECT:
-	case CURLE_COULDNT_RESOLVE_HOST:
-	case CURLE_OPERATION_TIMEDOUT:
-	case CURLE_SEND_ERROR:
-	case CURLE_RECV_ERROR:
-	  network_down = true;
-	  throw NO_NETWORK_CONNECTION;
-      }
-      return false;
+    cerr << "getFeed() Error: CURL ERROR IN OPERATION(" <<cd <<") \n";
+  } else {
+    long code = -1;
+    curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &code );
+    status = code;
+    if ( request == GET ) {
+      double ttfb = 0;
+      curl_easy_getinfo( curl, CURLINFO_STARTTRANSFER_TIME, &ttfb );
+      firstByteLatency.add( (long) ( ttfb * 1000 ) );
+    }
   }
-  network_down=false;
-  curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &status );
+  if ( ub.truncated ) cerr << "curlRequest::perform(): '"<<inFile<<"' got shorter while it was being uploaded.\n";
   if ( outfl ) fclose( outfl );
-  if ( infl ) fclose( infl );
   curl_slist_free_all( curlHDRS );
-};
+  return cd;
+}
+
+
+void curlRequest::recordTiming( void *curl, int code, long limitMS ) {
+  struct httpStats::timing t;
+  curl_easy_getinfo( curl, CURLINFO_NAMELOOKUP_TIME, &t.nameLookup );
+  curl_easy_getinfo( curl, CURLINFO_CONNECT_TIME, &t.connect );
+  curl_easy_getinfo( curl, CURLINFO_APPCONNECT_TIME, &t.appConnect );
+  curl_easy_getinfo( curl, CURLINFO_STARTTRANSFER_TIME, &t.startTransfer );
+  curl_easy_getinfo( curl, CURLINFO_TOTAL_TIME, &t.total );
+  curl_off_t down = 0, up = 0;
+  curl_easy_getinfo( curl, CURLINFO_SIZE_DOWNLOAD_T, &down );
+  curl_easy_getinfo( curl, CURLINFO_SIZE_UPLOAD_T, &up );
+  t.bytesDown = (double) down;
+  t.bytesUp = (double) up;
+  enum httpStats::endpointClass cls = endpoint;
+  if ( cls == httpStats::NUM_CLASSES ) cls = httpStats::classifyURL( URL );
+  httpStats::record( cls, t, ( code != CURLE_OK ) );
+  /* CURLE_OPERATION_TIMEDOUT is also what failed connects and stalled
+   * transfers end with, those are not our deadline */
+  deadline_hit = ( code == CURLE_OPERATION_TIMEDOUT && limitMS > 0 && t.connect > 0
+		   && t.total * 1000 + 1 >= limitMS );
+}
+
+/*
+ * Performs a GET on the (already configured) thread handle. If no body
+ * data arrives before the p95 time to first byte of recent requests, the
+ * same request is issued on a fresh connection and whichever copy starts
+ * delivering data first is kept while the other one is aborted.
+ */
+int curlRequest::performHedged( void *curl, void *outfl ) {
+  struct hedgeRace race;
+  race.winner = -1;
+  race.response = &response.str();
+  race.outfl = (FILE *) outfl;
+  race.sink = stream ? &stream : NULL;
+  race.started = &stream_started;
+  struct hedgeAttempt attempts[2];
+  struct responseSink sinks[2];
+  void *handles[2];
+  bool running[2];
+  CURLcode results[2];
 
+  curl_easy_setopt( curl, CURLOPT_HTTPGET, 1 );
+  curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, hedgedData );
+  handles[0] = curl;
+  handles[1] = curl_easy_duphandle( curl );
+  for( int i = 0; i < 2; i++ ) {
+    attempts[i].race = &race;
+    attempts[i].id = i;
+    attempts[i].curl = handles[i];
+    running[i] = false;
+    results[i] = CURLE_OK;
+    // Each copy collects its own headers, the body is reserved once a copy wins
+    sinks[i].body = NULL;
+    sinks[i].headers = &attempts[i].headers;
+    if ( handles[i] ) {
+      curl_easy_setopt( handles[i], CURLOPT_WRITEDATA, &attempts[i] );
+      curl_easy_setopt( handles[i], CURLOPT_HEADERDATA, &sinks[i] );
+    }
+  }
+  if ( handles[1] ) {
+    curl_easy_setopt( handles[1], CURLOPT_FRESH_CONNECT, 1 );
+    curl_easy_setopt( handles[1], CURLOPT_FORBID_REUSE, 1 );
+  }
+
+  long deadline = firstByteLatency.p95(), hedgeTimeout = 0;
+  count( hedgeable_count );
+  CURLM *multi = curl_multi_init();
+  curl_multi_add_handle( multi, handles[0] );
+  running[0] = true;
+  struct timeval start;
+  gettimeofday( &start, NULL );
+
+  int stillRunning, msgsLeft, done = -1, fallback = -1;
+  CURLMsg *msg;
+  while( done == -1 && ( running[0] || running[1] ) ) {
+    curl_multi_perform( multi, &stillRunning );
+    while( ( msg = curl_multi_info_read( multi, &msgsLeft ) ) ) {
+      if ( msg->msg != CURLMSG_DONE ) continue;
+      int i = ( msg->easy_handle == handles[0] ) ? 0 : 1;
+      results[i] = msg->data.result;
+      running[i] = false;
+      curl_multi_remove_handle( multi, handles[i] );
+      // A copy which was refused data lost the race, it does not count
+      if ( race.winner == i ) done = i;
+      else if ( race.winner == -1 && results[i] == CURLE_OK ) {
+	// An error response, unless the other copy still gets a good one
+	if ( running[1-i] ) fallback = i;
+	else done = i;
+      }
+    }
+    if ( done != -1 ) break;
+    if ( ! running[1] && handles[1] && race.winner == -1 && results[1] == CURLE_OK && running[0] && elapsedMS( start ) >= deadline ) {
+      cerr << "curlRequest::performHedged(): no data after " << deadline << "ms, hedging request for " << URL << endl;
+      // The copy gets only what is left of the deadline
+      if ( attempt_timeout > 0 ) {
+	hedgeTimeout = max( attempt_timeout - elapsedMS( start ), 1L );
+	curl_easy_setopt( handles[1], CURLOPT_TIMEOUT_MS, hedgeTimeout );
+	curl_easy_setopt( handles[1], CURLOPT_CONNECTTIMEOUT_MS, min( hedgeTimeout, CONNECT_TIMEOUT_MS ) );
+      }
+      curl_multi_add_handle( multi, handles[1] );
+      running[1] = true;
+      count( hedges_count );
+    }
+    curl_multi_wait( multi, NULL, 0, 50, NULL );
+  }
+
+  CURLcode cd;
+  if ( done == -1 && fallback != -1 ) done = fallback;
+  if ( done == -1 ) { // both copies failed, report the primary's error
+    done = 0;
+    cd = results[0];
+  } else cd = results[done];
+  responseHeaders.swap( attempts[done].headers );
+  if ( race.winner != done ) response.str().swap( attempts[done].errorBody );
+  recordTiming( handles[done], cd, done == 0 ? attempt_timeout : hedgeTimeout );
+  for( int i = 0; i < 2; i++ ) {
+    if ( running[i] ) curl_multi_remove_handle( multi, handles[i] );
+  }
+  curl_multi_cleanup( multi );
+
+  if ( cd ) {
+    cerr << "getFeed() Error: CURL ERROR IN OPERATION(" <<cd <<") \n";
+  } else {
+    long code = -1;
+    double ttfb = 0;
+    curl_easy_getinfo( handles[done], CURLINFO_RESPONSE_CODE, &code );
+    curl_easy_getinfo( handles[done], CURLINFO_STARTTRANSFER_TIME, &ttfb );
+    status = code;
+    if ( done == 0 ) firstByteLatency.add( (long) ( ttfb * 1000 ) );
+    else {
+      firstByteLatency.add( elapsedMS( start ) );
+      count( hedge_wins_count );
+    }
+  }
+  if ( handles[1] ) curl_easy_cleanup( handles[1] );
+  return cd;
+}
 
@@ -14,50 +14,140 @@
  *CHANGES:
  ***************************************************************/
 
+#include <sys/types.h>
+
 #include <string>
 #include <list>
 #include <map>
 #include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/function.hpp>
 
+#include "circuitBreaker.h"
+#include "httpStats.h"
+#include "bufferPool.h"
 
 
 
 
 class curlRequest { 
 	public:
-		enum requestType { GET, POST, PUT, DELETE, MULTIPART_POST };
+		enum requestType { GET, POST, PUT, DELETE, MULTIPART_POST, MULTIPART_PUT };
 		enum exceptionType { NO_NETWORK_CONNECTION };
+		/* Receives the body of a successful response as it arrives. A call
+		 * with len == 0 means the transfer starts over (it is being retried)
+		 * and everything received before is to be thrown away. */
+		typedef boost::function<void (const char *data, size_t len)> streamSink;
 		
 		static int handles_count;
+		static int retries_count;
+		static int hedgeable_count, hedges_count, hedge_wins_count;
+		static bool hedgingEnabled;
+		static circuitBreaker breaker;
+
+		/* How long a request may take depends on who waits for it. Each
+		 * class has a deadline (in seconds, 0 means none) for the whole
+		 * request including retries. */
+		enum deadlineClass { FOREGROUND_METADATA, FOREGROUND_READ, BACKGROUND, UPLOAD, NUM_DEADLINE_CLASSES };
+		/* Requests made by the current thread belong to cls while the scope exists */
+		class deadlineScope {
+			private:
+				int previous;
+			public:
+				deadlineScope( enum deadlineClass cls );
+				~deadlineScope();
+		};
+		static void setDeadline( enum deadlineClass cls, int seconds ) { deadlines[cls] = seconds; };
+		static int getDeadline( enum deadlineClass cls ) { return deadlines[cls]; };
+		static const char *deadlineClassName( enum deadlineClass cls );
+		// The class requests made by the current thread belong to (BACKGROUND if not set)
+		static enum deadlineClass currentClass();
+		static int timeouts_count;
+		// Aborts running transfers and makes further requests fail at once (used when unmounting)
+		static void cancelAll() { cancelled = true; };
 	private:
+		static int deadlines[NUM_DEADLINE_CLASSES];
+		static boost::thread_specific_ptr<int> thread_class;
+		static volatile bool cancelled;
+
 		static std::map<boost::thread::id,void*> curl_handles;
+		static boost::mutex curl_handles_mutex;
+		static const int maxRetries;
+		// The counters are incremented by many workers at once
+		static boost::mutex counters_mutex;
+		static void count( int &counter ) { boost::mutex::scoped_lock l(counters_mutex); counter++; };
 
 		enum requestType request;
-		std::string URL, body, postFields, outFile, inFile;
+		std::string URL, body, postFields, outFile, inFile, boundary, mediaType;
+		const std::string *bodyRef; // the data sent, either body or a string owned by the caller
+		off_t inOffset, inLength; // the part of inFile which is sent (inLength < 0 means up to the end)
 		std::list< std::string > headers;
+		std::string authorization;
+		streamSink stream;
 
-		std::string response;
+		pooledBuffer response;
+		std::map<std::string,std::string> responseHeaders; // keyed by lowercase name
 		int status;
 
 		static void *getThreadCurlHandle();
 		
 		bool network_down;
+		bool hedged;
+		long attempt_timeout; // ms, 0 for none
+		bool deadline_hit;    // the last attempt ran out of its own time, the host did answer
+		bool stream_started;  // the last attempt passed some of the body to stream
+		enum httpStats::endpointClass endpoint;
+
+		// limitMS is the timeout the handle had (0 for none)
+		void recordTiming( void *curl, int code, long limitMS );
+
+		int performOnce( long timeoutMS );
+		int performHedged( void *curl, void *outfl );
+		bool idempotent() const { return ( request == GET || request == PUT || request == DELETE || request == MULTIPART_PUT ); };
+		static bool isNetworkError( int code );
+		static bool isConnectError( int code );
+		static void backoff( int attempt );
+		static bool probe();
 
 	public:
 		curlRequest();
 
 		void addHeader( const std::string &header ){ headers.push_back(header);};
-		void setBody( const std::string &Body, const std::string contentType="application/atom+xml" ) { body=Body; headers.push_back("Content-Type: "+contentType); };
+		// Sets (or with "" removes) the Authorization header, a later call replaces the previous value
+		void setAuthorization( const std::string &value ) { authorization = value; };
+		void setBody( const std::string &Body, const std::string contentType="application/atom+xml" ) { body=Body; bodyRef=&body; headers.push_back("Content-Type: "+contentType); };
+		// Like setBody, but sends Body without copying it, so it must live until perform() returns
+		void setBodyRef( const std::string &Body, const std::string contentType="application/atom+xml" ) { bodyRef=&Body; headers.push_back("Content-Type: "+contentType); };
 		void setURL( const std::string &url ) { URL = url; };
 		void setType( const enum requestType reqType ) { request=reqType; };
 		void setOutFile( const std::string &fileName ) { outFile = fileName; };
+		/* The body of a successful response is passed to sink instead of
+		 * being collected (error responses are still available via getResponse) */
+		void setStreamSink( streamSink sink ) { stream = sink; };
 		void setInFile( const std::string &fileName, const std::string contentType ){ inFile=fileName; headers.push_back("Content-Type: "+contentType);};
+		// Sends only length bytes of fileName starting at offset
+		void setInFileRange( const std::string &fileName, off_t offset, off_t length, const std::string contentType ){ setInFile( fileName, contentType ); inOffset=offset; inLength=length; };
+		/* For MULTIPART_POST/MULTIPART_PUT: the body is a multipart/related message
+		 * consisting of the atom entry (not copied, must outlive perform()) followed
+		 * by the contents of fileName */
+		void setMultipart( const std::string &atomXML, const std::string &fileName, const std::string &mediaType );
+		// Allows a GET to be duplicated on a fresh connection if it is slow to answer
+		void setHedged( bool h ) { hedged = h; };
+		// Which histogram in .control/http_stats the request is counted in (guessed from the URL by default)
+		void setEndpointClass( enum httpStats::endpointClass cls ) { endpoint = cls; };
 
 		bool perform() throw (enum exceptionType);
+		// Frees the curl handle of the current thread (for short lived threads, before they exit)
+		static void releaseThreadHandle();
 		
 		bool checkNetworkConnection();
+		static bool networkAvailable() { return breaker.available(); };
 
-		std::string getResponse() const { return response; }
+		const std::string &getResponse() const { return response.str(); }
+		// Copies the body into out, so that both buffers keep their capacity (and their pool)
+		void takeResponse( std::string &out ) { out.assign( response.str() ); }
+		// Returns the value of the response header name (case insensitive) or "" if it was not sent
+		std::string getResponseHeader( const std::string &name ) const;
 		int getStatus() const { return status; };
 		int getHandlesCount() const { return handles_count; };
 };
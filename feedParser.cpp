@@ -0,0 +1,176 @@
+/***************************************************************
+ * feedParser.cpp
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description:
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include "feedParser.h"
+
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+using namespace std;
+
+
+feedParser::feedParser( entryCallback cb ): onEntry( cb ) {
+  reset();
+}
+
+void feedParser::reset() {
+  buf.clear();
+  head.clear();
+  rootName.clear();
+  nsDecls.clear();
+  scan = entryTagEnd = 0;
+  seenRoot = rootClosed = inEntry = false;
+  depth = 0;
+  entries = 0;
+}
+
+/* 1 if buf continues with p at pos, 0 if it does not and -1 if
+ * there is not enough input yet to decide */
+static int startsWith( const string &buf, string::size_type pos, const char *p ) {
+  size_t n = strlen( p ), avail = min( n, buf.size() - pos );
+  if ( buf.compare( pos, avail, p, avail ) != 0 ) return 0;
+  return ( avail == n ) ? 1 : -1;
+}
+
+/* The position just after the markup (tag, comment, CDATA section or
+ * processing instruction) starting at lt, npos if it is not complete yet */
+static string::size_type tokenEnd( const string &buf, string::size_type lt ) {
+  static const char *open[] = { "<!--", "<![CDATA[", "<?" };
+  static const char *close[] = { "-->", "]]>", "?>" };
+  for( int i = 0; i < 3; i++ ) {
+    int s = startsWith( buf, lt, open[i] );
+    if ( s < 0 ) return string::npos;
+    if ( s == 0 ) continue;
+    string::size_type e = buf.find( close[i], lt + strlen( open[i] ) );
+    return ( e == string::npos ) ? e : e + strlen( close[i] );
+  }
+  // A '>' inside a quoted attribute value does not end the tag
+  char quote = 0;
+  for( string::size_type i = lt + 1; i < buf.size(); i++ ) {
+    char c = buf[i];
+    if ( quote ) {
+      if ( c == quote ) quote = 0;
+    } else if ( c == '"' || c == '\'' ) quote = c;
+    else if ( c == '>' ) return i + 1;
+  }
+  return string::npos;
+}
+
+static string tagName( const string &buf, string::size_type pos ) {
+  string::size_type e = buf.find_first_of( " \t\r\n/>", pos );
+  return buf.substr( pos, e - pos );
+}
+
+void feedParser::collectNamespaces( string::size_type start, string::size_type end ) {
+  string::size_type pos = start;
+  while( ( pos = buf.find( "xmlns", pos ) ) != string::npos && pos < end ) {
+    if ( ! isspace( buf[pos-1] ) ) {
+      pos += 5;
+      continue;
+    }
+    string::size_type eq = buf.find( '=', pos );
+    if ( eq == string::npos || eq >= end ) break;
+    string::size_type q = buf.find_first_of( "\"'", eq );
+    if ( q == string::npos || q >= end ) break;
+    string::size_type qe = buf.find( buf[q], q + 1 );
+    if ( qe == string::npos || qe >= end ) break;
+    string name = buf.substr( pos, eq - pos );
+    name.erase( name.find_last_not_of( " \t\r\n" ) + 1 );
+    nsDecls.push_back( make_pair( name, buf.substr( pos, qe + 1 - pos ) ) );
+    pos = qe + 1;
+  }
+}
+
+// Whether the start tag has the attribute name
+static bool declares( const string &startTag, const string &name ) {
+  for( string::size_type d = startTag.find( name ); d != string::npos; d = startTag.find( name, d + 1 ) ) {
+    string::size_type after = startTag.find_first_not_of( " \t\r\n", d + name.size() );
+    if ( isspace( startTag[d-1] ) && after != string::npos && startTag[after] == '=' ) return true;
+  }
+  return false;
+}
+
+// WARNING: buf must start with the entry, which ends at end
+void feedParser::emitEntry( string::size_type end ) {
+  string entry( buf, 0, end );
+  buf.erase( 0, end );
+  string startTag( entry, 0, entryTagEnd );
+  string::size_type insertAt = entryTagEnd - ( entry[entryTagEnd-2] == '/' ? 2 : 1 );
+  string decls;
+  for( list< pair<string,string> >::iterator ns = nsDecls.begin(); ns != nsDecls.end(); ++ns ) {
+    if ( ! declares( startTag, ns->first ) ) decls += " " + ns->second;
+  }
+  entry.insert( insertAt, decls );
+  entries++;
+  onEntry( entry );
+}
+
+void feedParser::process() {
+  while( true ) {
+    string::size_type lt = buf.find( '<', scan );
+    if ( lt == string::npos ) {
+      scan = buf.size();
+      break;
+    }
+    string::size_type end = tokenEnd( buf, lt );
+    if ( end == string::npos ) {
+      scan = lt;
+      break;
+    }
+    scan = end;
+    if ( buf[lt+1] == '!' || buf[lt+1] == '?' ) continue;
+    bool closing = ( buf[lt+1] == '/' ), empty = ( ! closing && buf[end-2] == '/' );
+    string name = tagName( buf, lt + ( closing ? 2 : 1 ) );
+    if ( ! seenRoot ) {
+      seenRoot = true;
+      rootName = name;
+      collectNamespaces( lt, end );
+    } else if ( ! inEntry ) {
+      if ( closing && name == rootName ) rootClosed = true;
+      if ( closing || name != "entry" ) continue;
+      head.append( buf, 0, lt );
+      buf.erase( 0, lt );
+      scan = entryTagEnd = end - lt;
+      inEntry = true;
+      depth = empty ? 0 : 1;
+    } else if ( name == "entry" ) {
+      if ( closing ) depth--;
+      else if ( ! empty ) depth++;
+    }
+    if ( inEntry && depth == 0 ) {
+      emitEntry( scan );
+      inEntry = false;
+      scan = 0;
+    }
+  }
+  // Outside of entries the input is only kept as part of the feed
+  if ( ! inEntry ) {
+    head.append( buf, 0, scan );
+    buf.erase( 0, scan );
+    scan = 0;
+  }
+}
+
+void feedParser::feed( const char *data, size_t len ) {
+  buf.append( data, len );
+  process();
+}
+
+bool feedParser::finish() {
+  if ( ! inEntry ) {
+    head += buf;
+    buf.clear();
+  }
+  return ( rootClosed && ! inEntry );
+}
@@ -0,0 +1,68 @@
+#ifndef _feedParser_H
+#define _feedParser_H
+
+/***************************************************************
+ * feedParser.h
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description: Splits an atom feed into its entries while it is being
+ *              downloaded. The input is fed in arbitrary chunks (as
+ *              they come from curl) and each <entry> element is handed
+ *              to the callback as soon as its end tag arrives, so only
+ *              the entry being received is kept in memory. The namespace
+ *              declarations of the feed element are copied into every
+ *              entry, so that each of them is a standalone document.
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include <string>
+#include <list>
+#include <utility>
+
+#include <boost/function.hpp>
+
+
+class feedParser {
+	public:
+		typedef boost::function<void (const std::string &)> entryCallback;
+
+	private:
+		entryCallback onEntry;
+		std::string buf;              // unprocessed input, starts with the current entry if inside one
+		std::string::size_type scan;  // buf is tokenized up to here
+		std::string::size_type entryTagEnd; // end of the start tag of the current entry
+		std::string head;             // the feed without its entries
+		std::string rootName;
+		std::list< std::pair<std::string, std::string> > nsDecls; // xmlns attributes of the feed element (name, name='value')
+		bool seenRoot, rootClosed, inEntry;
+		int depth;
+		unsigned long entries;
+
+		void process();
+		void emitEntry( std::string::size_type end );
+		void collectNamespaces( std::string::size_type start, std::string::size_type end );
+
+	public:
+		feedParser( entryCallback cb );
+
+		/* Consumes the next chunk of the feed, calling the callback for
+		 * each entry completed by it */
+		void feed( const char *data, size_t len );
+		// Forgets everything received so far (when the transfer starts over)
+		void reset();
+		/* Called after the last chunk, returns false if the feed was
+		 * truncated (e.g. in the middle of an entry) */
+		bool finish();
+
+		// The feed element with everything except the entries (title, links, ...)
+		const std::string &getFeedXML() const { return head; };
+		unsigned long entryCount() const { return entries; };
+};
+
+
+#endif /* _feedParser_H */
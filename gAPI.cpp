@@ -21,16 +21,38 @@
 #endif
 #include "ticpp/ticpp.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <time.h>
+
 #include <string>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 
 using namespace std;
 
+const off_t gAPI::resumableThreshold = 8*1024*1024;
+// The protocol requires chunks to be multiples of 256Kb
+const off_t gAPI::resumableChunkSize = 4*1024*1024;
+const time_t gAPI::tokenLifetime = 7*24*3600;
+
 
 bool gAPI::haveToken() const { 
+  boost::mutex::scoped_lock l(token_mutex);
   return (authToken.compare("") != 0);
 }
 
+string gAPI::currentToken() const {
+  boost::mutex::scoped_lock l(token_mutex);
+  return authToken;
+}
+
 
 void gAPI::dropAuthKey( std::string &URL ) { 
   int authKeyPos = URL.find( "?authkey=" );
@@ -61,18 +83,93 @@ bool gAPI::haveAuthKey( const std::string &URL ) {
 
 
 gAPI::gAPI( const string &user, const string app ) :
-	userName( user ), appName(app), authToken("")
+	userName( user ), appName(app), authToken(""), tokenAcquired(0)
 {
 }
 
-bool gAPI::login( const string &password, const string &user ) throw ( enum exceptionType ) { 
+bool gAPI::login( const string &pass, const string &user ) throw ( enum exceptionType ) { 
   if ( user.compare("") == 0 && userName.compare("") == 0 ) return false;
-  if ( password.compare("") == 0 ) return false;
   if ( user.compare("") != 0 ) userName = user;
+  if ( pass.compare("") != 0 ) password = pass;
+  if ( loadToken() ) return true;
+  if ( password.compare("") == 0 ) return false;
   getAuthToken( password );
   return haveToken();
 }
 
+/* The token file holds the user name, the time the token was obtained and the token */
+bool gAPI::loadToken() {
+  if ( tokenFile == "" ) return false;
+  ifstream in( tokenFile.c_str() );
+  string user, token;
+  time_t acquired = 0;
+  if ( ! ( in >> user >> acquired >> token ) ) return false;
+  if ( user != userName || time( NULL ) - acquired > tokenLifetime ) return false;
+  boost::mutex::scoped_lock l(token_mutex);
+  authToken = token;
+  tokenAcquired = acquired;
+  return true;
+}
+
+// WARNING: Need to acquire a lock on token_mutex before calling this function.
+void gAPI::saveToken() const {
+  if ( tokenFile == "" ) return;
+  string tmp = tokenFile + ".tmp";
+  int fd = open( tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+  if ( fd < 0 ) {
+    cerr << "gAPI::saveToken: cannot create " << tmp << "\n";
+    return;
+  }
+  fchmod( fd, 0600 ); // The mode is not changed if the file already existed
+  stringstream ss;
+  ss << userName << "\n" << tokenAcquired << "\n" << authToken << "\n";
+  string data = ss.str();
+  bool ok = ( write( fd, data.data(), data.size() ) == (ssize_t) data.size() );
+  ok = ( close( fd ) == 0 && ok );
+  if ( ! ok || rename( tmp.c_str(), tokenFile.c_str() ) != 0 ) {
+    cerr << "gAPI::saveToken: could not save the auth token to " << tokenFile << "\n";
+    unlink( tmp.c_str() );
+  }
+}
+
+/*
+ * Called when the server answered 401 to a request made with the token
+ * rejected. Returns true if there is a different token to retry with.
+ */
+bool gAPI::refreshToken( const string &rejected ) throw ( enum exceptionType ) {
+  // The requests rejected together wait for a single login
+  boost::mutex::scoped_lock ll(login_mutex);
+  {
+    boost::mutex::scoped_lock l(token_mutex);
+    if ( authToken != rejected ) return ( authToken != "" ); // Somebody else got a new one in the meantime
+    if ( tokenFile != "" ) unlink( tokenFile.c_str() );
+  }
+  if ( password == "" ) return false;
+  cerr << "gAPI::refreshToken: auth token rejected, logging in again\n";
+  // The rejected token stays in place until there is a new one
+  requestToken( password );
+  boost::mutex::scoped_lock l(token_mutex);
+  return ( authToken != rejected && authToken != "" );
+}
+
+bool gAPI::perform( curlRequest &request ) throw ( enum exceptionType ) {
+  bool ret = false;
+  for( int attempt = 0; attempt < 2; attempt++ ) {
+    string token = currentToken();
+    if ( attempt > 0 && token == "" ) break; // never repeat a request without the token
+    request.setAuthorization( token == "" ? "" : "GoogleLogin auth=" + token );
+    try {
+      ret = request.perform();
+    } catch ( curlRequest::exceptionType ex ) {
+      if ( ex == curlRequest::NO_NETWORK_CONNECTION ) throw NO_NETWORK_CONNECTION;
+      else throw GENERAL_ERROR;
+    }
+    if ( request.getStatus() != UNAUTHORIZED || token == "" || attempt > 0 ) break;
+    if ( ! refreshToken( token ) ) break;
+  }
+  return ret;
+}
+
 string gAPI::getUser() const { 
   int atPos = userName.find_first_of("@");
   return userName.substr(0,atPos);
@@ -95,6 +192,12 @@ bool gAPI::checkNetworkConnection() {
 
 
 void gAPI::getAuthToken(const string& password) throw ( enum exceptionType ) {
+  boost::mutex::scoped_lock ll(login_mutex);
+  requestToken( password );
+}
+
+// WARNING: Need to acquire a lock on login_mutex before calling this function.
+void gAPI::requestToken(const string& password) throw ( enum exceptionType ) {
   curlRequest request;
   request.setURL( "https://www.google.com/accounts/ClientLogin" );
   request.setBody("Email="+userName+"&Passwd="+password+"&accountType=GOOGLE&source="+appName+"&service=lh2", "application/x-www-form-urlencoded");
@@ -105,24 +208,26 @@ void gAPI::getAuthToken(const string& password) throw ( enum exceptionType ) {
     if ( ex == curlRequest::NO_NETWORK_CONNECTION ) throw NO_NETWORK_CONNECTION;
     else throw GENERAL_ERROR;
   }
-  if ( request.getStatus() != 200 ) {
+  string token = extractVal( request.getResponse(), "Auth" );
+  if ( request.getStatus() != 200 || token == "" ) {
     cerr << "gAPI::getAuthToken: "<< extractVal( request.getResponse(), "Error" ) << " (response status "<<request.getStatus() << ")\n";
-  } else authToken = extractVal( request.getResponse(), "Auth" );
+  } else {
+    boost::mutex::scoped_lock l(token_mutex);
+    authToken = token;
+    tokenAcquired = time( NULL );
+    saveToken();
+  }
 }
 
 
 bool gAPI::DOWNLOAD( const std::string &URL, const std::string &fileName ) throw ( enum exceptionType ) { 
   curlRequest request;
-  if ( haveToken() )  request.addHeader( "Authorization: GoogleLogin auth="+authToken );
   request.setType( curlRequest::GET );
+  request.setHedged( true );
+  request.setEndpointClass( httpStats::MEDIA_DOWNLOAD );
   request.setURL( URL );
   request.setOutFile( fileName );
-  try {
-    if ( ! request.perform() ) return false;
-  } catch ( curlRequest::exceptionType ex ) {
-    if ( ex == curlRequest::NO_NETWORK_CONNECTION ) throw NO_NETWORK_CONNECTION;
-    else throw GENERAL_ERROR;
-  }    
+  if ( ! perform( request ) ) return false;
   if ( request.getStatus() != 200 ) {
     cerr << "gAPI::DOWNLOAD: "<<request.getResponse() << "(response status "<<request.getStatus() << ")\n";
     return false;
@@ -132,56 +237,85 @@ bool gAPI::DOWNLOAD( const std::string &URL, const std::string &fileName ) throw
 
 
 string gAPI::GET( const std::string& feedURL ) throw (enum exceptionType) {
+  string ret;
+  GET( feedURL, ret );
+  return ret;
+}
+
+bool gAPI::GET( const std::string& feedURL, std::string &response ) throw (enum exceptionType) {
   curlRequest request;
-  if ( haveToken() )  request.addHeader( "Authorization: GoogleLogin auth="+authToken );
   request.setType( curlRequest::GET );
+  request.setHedged( true );
   request.setURL( feedURL );
-  try {
-    request.perform();
-  } catch ( curlRequest::exceptionType ex ) {
-    if ( ex == curlRequest::NO_NETWORK_CONNECTION ) throw NO_NETWORK_CONNECTION;
-    else throw GENERAL_ERROR;
-  }
+  perform( request );
   if ( request.getStatus() != OK && request.getStatus() != CREATED && request.getStatus() != NOT_MODIFIED ) {
     cerr << "gAPI::GET: ERROR"<<endl;
     cerr << "   Response status: "<<request.getStatus() << endl;
     cerr << "   Offending URL: " << feedURL << endl;
     cerr << "   Response---------------------" <<endl;
     cerr << request.getResponse()<<endl;
-    return "";
+    response.clear();
+    return false;
   }
-  return request.getResponse();
+  request.takeResponse( response );
+  return true;
+}
+
+static string urlEncode( const string &value ) {
+  static const char *hex = "0123456789ABCDEF";
+  string ret;
+  for( string::const_iterator c = value.begin(); c != value.end(); ++c ) {
+    if ( isalnum( (unsigned char) *c ) || *c == '-' || *c == '_' || *c == '.' || *c == '~' ) ret += *c;
+    else {
+      ret += '%';
+      ret += hex[ (unsigned char) *c >> 4 ];
+      ret += hex[ *c & 0x0F ];
+    }
+  }
+  return ret;
+}
+
+bool gAPI::STREAM( const std::string& feedURL, boost::function<void (const char *, size_t)> sink, const std::string &fields, int *status ) throw (enum exceptionType) {
+  curlRequest request;
+  request.setType( curlRequest::GET );
+  if ( fields != "" ) {
+    // Partial responses are only available in version 2 of the protocol
+    request.setURL( feedURL + ( feedURL.find( '?' ) == string::npos ? "?" : "&" ) + "fields=" + urlEncode( fields ) );
+    request.addHeader( "GData-Version: 2" );
+  } else request.setURL( feedURL );
+  request.setStreamSink( sink );
+  request.setHedged( true );
+  bool done = perform( request );
+  if ( status ) *status = request.getStatus();
+  if ( ! done ) return false;
+  if ( request.getStatus() != OK ) {
+    cerr << "gAPI::STREAM: ERROR"<<endl;
+    cerr << "   Response status: "<<request.getStatus() << endl;
+    cerr << "   Offending URL: " << feedURL << endl;
+    cerr << "   Response---------------------" <<endl;
+    cerr << request.getResponse()<<endl;
+    return false;
+  }
+  return true;
 }
 
 string gAPI::DELETE( const string &URL ) throw (enum exceptionType) {
   curlRequest request;
-  if ( haveToken() )  request.addHeader( "Authorization: GoogleLogin auth="+authToken );
   request.addHeader("If-Match: *");
   request.setType( curlRequest::DELETE );
   request.setURL( URL );
-  try {
-    request.perform();
-  } catch ( curlRequest::exceptionType ex ) {
-    if ( ex == curlRequest::NO_NETWORK_CONNECTION ) throw NO_NETWORK_CONNECTION;
-    else throw GENERAL_ERROR;
-  }
+  perform( request );
   return request.getResponse();
 }
 
 
 string gAPI::PUT( const string &URL, const string &data ) throw (enum exceptionType) {
   curlRequest request;
-  if ( haveToken() )  request.addHeader( "Authorization: GoogleLogin auth="+authToken );
   request.addHeader("If-Match: *");
   request.setType( curlRequest::PUT );
   request.setURL( URL );
-  request.setBody( data, "application/atom+xml" );
-  try {
-    request.perform();
-  } catch ( curlRequest::exceptionType ex ) {
-    if ( ex == curlRequest::NO_NETWORK_CONNECTION ) throw NO_NETWORK_CONNECTION;
-    else throw GENERAL_ERROR;
-  }
+  request.setBodyRef( data, "application/atom+xml" );
+  perform( request );
   if ( request.getStatus() != OK && request.getStatus() != CREATED && request.getStatus() != NOT_MODIFIED ) { 
     cerr << "gAPI::PUT: ERROR"<<endl;
     cerr << "   Response status: "<<request.getStatus() << endl;
@@ -198,16 +332,10 @@ string gAPI::PUT( const string &URL, const string &data ) throw (enum exceptionT
 
 string gAPI::POST( const string &URL, const string &data ) throw (enum exceptionType) {
   curlRequest request;
-  if ( haveToken() )  request.addHeader( "Authorization: GoogleLogin auth="+authToken );
   request.setType( curlRequest::POST );
   request.setURL( URL );
-  request.setBody( data, "application/atom+xml" );
-  try {
-    request.perform();
-  } catch ( curlRequest::exceptionType ex ) {
-    if ( ex == curlRequest::NO_NETWORK_CONNECTION ) throw NO_NETWORK_CONNECTION;
-    else throw GENERAL_ERROR;
-  }
+  request.setBodyRef( data, "application/atom+xml" );
+  perform( request );
   if ( request.getStatus() != 200 && request.getStatus() != 201 ) { 
     cerr << "gAPI::PUT: "<<request.getResponse() << "(response status "<<request.getStatus() << ")\n";
     return "";
@@ -217,22 +345,17 @@ string gAPI::POST( const string &URL, const string &data ) throw (enum exception
 
 string gAPI::POST_FILE( const string &URL, const string &file, const string &contentType, list<string> &headers, bool methodPOST ) throw (enum exceptionType) {
  curlRequest request;
-  if ( haveToken() )  request.addHeader( "Authorization: GoogleLogin auth="+authToken );
   if ( methodPOST ) request.setType( curlRequest::POST );
   else {
     request.addHeader("If-Match: *");
     request.setType( curlRequest::PUT );
   }
+  request.setEndpointClass( httpStats::UPLOAD );
   request.setURL( URL );
   request.setInFile( file, contentType );
   for( list<string>::iterator hdr = headers.begin(); hdr != headers.end(); hdr++ )
     request.addHeader( *hdr );
-  try {
-    request.perform();
-  } catch ( curlRequest::exceptionType ex ) {
-    if ( ex == curlRequest::NO_NETWORK_CONNECTION ) throw NO_NETWORK_CONNECTION;
-    else throw GENERAL_ERROR;
-  }
+  perform( request );
   if ( request.getStatus() != 200 && request.getStatus() != 201 ) { 
     cerr << "gAPI::POST_FILE: "<<request.getResponse() << " (response status "<<request.getStatus() << ")\n";
     cerr << "gAPI::POST_FILE to " << URL << " of " << file << " ("<<contentType<<")\n";
@@ -245,16 +368,166 @@ string gAPI::PUT_FILE( const string &feedURL, const string &fileName, const stri
   return POST_FILE( feedURL, fileName, contentType, headers, false );
 }
 
+string gAPI::POST_MULTIPART( const string &URL, const string &atomXML, const string &file, const string &contentType, bool methodPOST ) throw (enum exceptionType) {
+  curlRequest request;
+  if ( methodPOST ) request.setType( curlRequest::MULTIPART_POST );
+  else {
+    request.addHeader("If-Match: *");
+    request.setType( curlRequest::MULTIPART_PUT );
+  }
+  request.setEndpointClass( httpStats::UPLOAD );
+  request.setURL( URL );
+  request.setMultipart( atomXML, file, contentType );
+  perform( request );
+  if ( request.getStatus() != 200 && request.getStatus() != 201 ) {
+    cerr << "gAPI::POST_MULTIPART: "<<request.getResponse() << " (response status "<<request.getStatus() << ")\n";
+    cerr << "gAPI::POST_MULTIPART to " << URL << " of " << file << " ("<<contentType<<")\n";
+    return "";
+  }
+  return request.getResponse();
+}
+
+string gAPI::PUT_MULTIPART( const string &feedURL, const string &atomXML, const string &fileName, const string &contentType ) throw (enum exceptionType) {
+  return POST_MULTIPART( feedURL, atomXML, fileName, contentType, false );
+}
+
+
+
+/* Parses the Range header of a 308 response ("bytes=0-1234") and returns
+ * the offset the upload should continue from */
+off_t gAPI::nextUploadOffset( const string &rangeHeader ) {
+  string::size_type dash = rangeHeader.find( '-' );
+  if ( dash == string::npos ) return 0;
+  return strtoll( rangeHeader.c_str() + dash + 1, NULL, 10 ) + 1;
+}
+
+/* The session file holds the session URL together with the size and
+ * modification time of the file it belongs to, so that a session is
+ * never continued with different data */
+static string loadUploadSession( const string &sessionFile, const struct stat &st ) {
+  ifstream in( sessionFile.c_str() );
+  string URL;
+  off_t size = -1;
+  time_t mtime = 0;
+  if ( ! ( in >> URL >> size >> mtime ) ) return "";
+  if ( size != st.st_size || mtime != st.st_mtime ) {
+    unlink( sessionFile.c_str() );
+    return "";
+  }
+  return URL;
+}
+
+static void saveUploadSession( const string &sessionFile, const string &URL, const struct stat &st ) {
+  string tmp = sessionFile + ".tmp";
+  ofstream out( tmp.c_str() );
+  out << URL << "\n" << st.st_size << "\n" << st.st_mtime << "\n";
+  out.close();
+  if ( ! out || rename( tmp.c_str(), sessionFile.c_str() ) != 0 )
+    cerr << "gAPI::UPLOAD_RESUMABLE: could not save upload session to " << sessionFile << "\n";
+}
+
+string gAPI::UPLOAD_RESUMABLE( const string &URL, const string &atomXML, const string &file, const string &contentType, const string &sessionFile, bool methodPOST ) throw (enum exceptionType) {
+  struct stat st;
+  if ( stat( file.c_str(), &st ) != 0 ) {
+    cerr << "gAPI::UPLOAD_RESUMABLE: cannot stat " << file << "\n";
+    return "";
+  }
+  off_t total = st.st_size, offset = 0;
+  string session = loadUploadSession( sessionFile, st );
+  stringstream range;
 
+  // Ask the server how much of an interrupted upload it already has
+  if ( session != "" ) {
+    curlRequest request;
+    request.setType( curlRequest::PUT );
+    request.setEndpointClass( httpStats::UPLOAD );
+    request.setURL( session );
+    range << "Content-Range: bytes */" << total;
+    request.addHeader( range.str() );
+    request.setBody( "", contentType );
+    perform( request );
+    if ( request.getStatus() == 200 || request.getStatus() == 201 ) {
+      unlink( sessionFile.c_str() );
+      return request.getResponse();
+    }
+    if ( request.getStatus() == 308 ) {
+      offset = nextUploadOffset( request.getResponseHeader( "Range" ) );
+      cerr << "gAPI::UPLOAD_RESUMABLE: resuming upload of " << file << " at " << offset << "/" << total << "\n";
+    } else {
+      cerr << "gAPI::UPLOAD_RESUMABLE: session for " << file << " expired (response status "<<request.getStatus() << ")\n";
+      unlink( sessionFile.c_str() );
+      session = "";
+    }
+  }
+
+  if ( session == "" ) {
+    curlRequest request;
+    if ( methodPOST ) request.setType( curlRequest::POST );
+    else {
+      request.addHeader("If-Match: *");
+      request.setType( curlRequest::PUT );
+    }
+    request.setEndpointClass( httpStats::UPLOAD );
+    request.setURL( URL );
+    request.addHeader( "X-Upload-Content-Type: " + contentType );
+    range.str( "" );
+    range << "X-Upload-Content-Length: " << total;
+    request.addHeader( range.str() );
+    request.setBodyRef( atomXML );
+    perform( request );
+    session = request.getResponseHeader( "Location" );
+    if ( request.getStatus() != 200 || session == "" ) {
+      cerr << "gAPI::UPLOAD_RESUMABLE: "<<request.getResponse() << " (response status "<<request.getStatus() << ")\n";
+      cerr << "gAPI::UPLOAD_RESUMABLE: could not start upload session at " << URL << " for " << file << "\n";
+      return "";
+    }
+    saveUploadSession( sessionFile, session, st );
+    offset = 0;
+  }
+
+  int stalled = 0;
+  while( stalled < 3 ) {
+    off_t len = total - offset;
+    if ( len > resumableChunkSize ) len = resumableChunkSize;
+    curlRequest request;
+    request.setType( curlRequest::PUT );
+    request.setEndpointClass( httpStats::UPLOAD );
+    request.setURL( session );
+    request.setInFileRange( file, offset, len, contentType );
+    range.str( "" );
+    if ( len > 0 ) range << "Content-Range: bytes " << offset << "-" << offset + len - 1 << "/" << total;
+    else range << "Content-Range: bytes */" << total;
+    request.addHeader( range.str() );
+    // If this throws, the session file stays and the next attempt continues from where the server got
+    perform( request );
+    if ( request.getStatus() == 200 || request.getStatus() == 201 ) {
+      unlink( sessionFile.c_str() );
+      return request.getResponse();
+    }
+    if ( request.getStatus() != 308 ) {
+      cerr << "gAPI::UPLOAD_RESUMABLE: "<<request.getResponse() << " (response status "<<request.getStatus() << ")\n";
+      cerr << "gAPI::UPLOAD_RESUMABLE: upload of " << file << " failed at " << offset << "/" << total << "\n";
+      if ( request.getStatus() == 404 || request.getStatus() == 410 ) unlink( sessionFile.c_str() );
+      return "";
+    }
+    off_t next = nextUploadOffset( request.getResponseHeader( "Range" ) );
+    if ( next > offset ) stalled = 0;
+    else stalled++;
+    offset = next;
+  }
+  cerr << "gAPI::UPLOAD_RESUMABLE: upload of " << file << " makes no progress at " << offset << "/" << total << "\n";
+  return "";
+}
 
 set<string> gAPI::albumList( const string &user ) throw (enum gAPI::exceptionType ) {
   string URL = "http://picasaweb.google.com/data/feed/api/user/"+user;
   set<string> ret;
   if (user.compare("") == 0) URL+=userName;
-  string feedXML = GET( URL );
+  pooledBuffer feedXML;
+  GET( URL, feedXML.str() );
   ticpp::Document xml;
   try {
-    xml.Parse( feedXML );
+    xml.Parse( feedXML.str() );
     ticpp::Iterator< ticpp::Element > albumItem("entry");
     for( albumItem = albumItem.begin( xml.FirstChildElement() ); albumItem != albumItem.end(); albumItem++ ) {
       ret.insert( albumItem->FirstChildElement( "title" )->GetText() );
@@ -283,6 +556,7 @@ ostream &operator<<(ostream &out, const gAPI &api) {
   out << "Logged in:";
   if ( api.loggedIn() ) {
     out << "true" << endl;
-    out << "AuthToken:" << api.authToken << endl;
+    out << "AuthToken obtained:" << ( time( NULL ) - api.tokenAcquired ) / 60 << " minutes ago" << endl;
   } else out << "false" << endl;
+  return out;
 }
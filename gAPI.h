@@ -14,11 +14,18 @@
  *CHANGES:
  ***************************************************************/
 
+#include <sys/types.h>
+
 #include <string>
 #include <set>
 #include <list>
 #include <iosfwd>
 
+#include <boost/thread/mutex.hpp>
+#include <boost/function.hpp>
+
+class curlRequest;
+
 
 class gAPI {
 	public:
@@ -26,6 +33,19 @@ class gAPI {
 
 	private:
 		std::string userName, authToken, appName;
+		std::string password; // kept to get a new token when the current one is rejected
+		std::string tokenFile;
+		time_t tokenAcquired;
+		mutable boost::mutex token_mutex;
+		boost::mutex login_mutex; // only one login at a time
+
+		// ClientLogin tokens are valid for about two weeks, do not use them that long
+		static const time_t tokenLifetime;
+
+		bool loadToken();
+		void saveToken() const;
+		bool refreshToken( const std::string &rejected ) throw ( enum exceptionType );
+		void requestToken( const std::string &password ) throw ( enum exceptionType );
 
 	protected:
 	  
@@ -40,8 +60,13 @@ class gAPI {
 				      INTERNAL_SEVER_ERROR = 500 };
 
 		bool haveToken() const;
+		std::string currentToken() const;
 		void getAuthToken( const std::string &password ) throw ( enum exceptionType );
 
+		/* Performs request with the current auth token. If the server rejects
+		 * the token (401), a new one is obtained and the request is repeated. */
+		bool perform( curlRequest &request ) throw ( enum exceptionType );
+
 
 
 		static void dropAuthKey( std::string &URL );
@@ -49,7 +74,10 @@ class gAPI {
 		static std::string getAuthKey( const std::string &URL );
 		static bool haveAuthKey( const std::string &URL );
 
+		static const off_t resumableChunkSize;
+
 		static int string2int(const std::string &number);
+		static off_t nextUploadOffset( const std::string &rangeHeader );
 		static std::string extractVal( const std::string response, const std::string key );
 
 
@@ -58,16 +86,39 @@ class gAPI {
 		std::string POST( const std::string &feedURL, const std::string &data ) throw ( enum exceptionType );
 		std::string POST_FILE( const std::string &feedURL, const std::string &fileName, const std::string &contentType, std::list< std::string > &headers, bool methodPOST=true ) throw ( enum exceptionType );
 		std::string PUT_FILE( const std::string &feedURL, const std::string &fileName, const std::string &contentType, std::list< std::string > &headers ) throw ( enum exceptionType );
+		/* Sends the atom entry together with the media in fileName as a single
+		 * multipart/related request (POST creates, PUT replaces both) */
+		std::string POST_MULTIPART( const std::string &feedURL, const std::string &atomXML, const std::string &fileName, const std::string &contentType, bool methodPOST=true ) throw ( enum exceptionType );
+		std::string PUT_MULTIPART( const std::string &feedURL, const std::string &atomXML, const std::string &fileName, const std::string &contentType ) throw ( enum exceptionType );
+		/* Uploads fileName (with the atom entry as metadata) in chunks using the
+		 * resumable upload protocol. The session URL is kept in sessionFile, so if the
+		 * upload is interrupted (even by a remount) a later call with the same
+		 * sessionFile continues from the last offset acknowledged by the server. */
+		std::string UPLOAD_RESUMABLE( const std::string &sessionURL, const std::string &atomXML, const std::string &fileName, const std::string &contentType, const std::string &sessionFile, bool methodPOST=true ) throw ( enum exceptionType );
 
 	public:
 
+		// Files at least this large are uploaded using UPLOAD_RESUMABLE
+		static const off_t resumableThreshold;
+
 		std::string GET( const std::string &feedURL ) throw ( enum exceptionType );
+		// Stores the body into response (reusing its buffer), returns false on error
+		bool GET( const std::string &feedURL, std::string &response ) throw ( enum exceptionType );
+		/* Passes the body to sink while it is being downloaded (see curlRequest::setStreamSink),
+		 * returns false on error. If fields is not empty, only the given fields are requested
+		 * (a GData partial response, e.g. "entry(title,link)"). The HTTP status is stored
+		 * into status if given. */
+		bool STREAM( const std::string &feedURL, boost::function<void (const char *, size_t)> sink, const std::string &fields = "", int *status = NULL ) throw ( enum exceptionType );
 		bool DOWNLOAD( const std::string &URL, const std::string &fileName ) throw ( enum exceptionType );
 
 		gAPI( const std::string &user = "", const std::string app = "gAPI" );
 		~gAPI();
 
+		/* Uses the token saved in the token file if it was obtained for the same
+		 * user and did not expire yet, otherwise logs in with password */
 		bool login( const std::string &password, const std::string &user = "") throw ( enum exceptionType );
+		// Where the auth token is kept between mounts (created with mode 0600)
+		void setTokenFile( const std::string &fileName ) { tokenFile = fileName; };
 		bool loggedIn() const { return haveToken(); };
 		std::string getUser() const;
 
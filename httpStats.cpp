@@ -0,0 +1,127 @@
+/***************************************************************
+ * httpStats.cpp
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description:
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include "httpStats.h"
+
+#include <string.h>
+
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+boost::mutex httpStats::stats_mutex;
+struct httpStats::classStats httpStats::stats[httpStats::NUM_CLASSES];
+
+int httpStats::bucket( double ms ) {
+  int b = 0;
+  double limit = 1;
+  while( b < NUM_BUCKETS-1 && ms >= limit ) {
+    limit *= 2;
+    b++;
+  }
+  return b;
+}
+
+/* Upper bound of the bucket containing the pct-th percentile */
+double httpStats::percentile( const unsigned long *histogram, unsigned long count, int pct ) {
+  if ( count == 0 ) return 0;
+  unsigned long rank = ( count * pct + 99 ) / 100, seen = 0;
+  for( int b = 0; b < NUM_BUCKETS; b++ ) {
+    seen += histogram[b];
+    if ( seen >= rank ) return (double) ( 1 << b );
+  }
+  return (double) ( 1 << (NUM_BUCKETS-1) );
+}
+
+void httpStats::record( enum endpointClass cls, const struct timing &t, bool error ) {
+  double ms[NUM_PHASES];
+  double connected = ( t.appConnect > 0 ) ? t.appConnect : t.connect;
+  ms[DNS] = t.nameLookup;
+  ms[CONNECT] = t.connect - t.nameLookup;
+  ms[TLS] = ( t.appConnect > 0 ) ? t.appConnect - t.connect : 0;
+  ms[WAIT] = t.startTransfer - connected;
+  ms[TRANSFER] = t.total - t.startTransfer;
+  ms[TOTAL] = t.total;
+  for( int i = 0; i < NUM_PHASES; i++ ) {
+    ms[i] *= 1000;
+    if ( ms[i] < 0 ) ms[i] = 0;
+  }
+
+  boost::mutex::scoped_lock l(stats_mutex);
+  struct classStats &s = stats[cls];
+  s.requests++;
+  if ( error ) s.errors++;
+  s.bytesDown += t.bytesDown;
+  s.bytesUp += t.bytesUp;
+  for( int i = 0; i < NUM_PHASES; i++ ) {
+    s.sum[i] += ms[i];
+    s.histogram[i][bucket( ms[i] )]++;
+  }
+}
+
+enum httpStats::endpointClass httpStats::classifyURL( const string &URL ) {
+  if ( URL.find( "/data/feed/" ) != string::npos ) return FEED;
+  if ( URL.find( "/data/entry/" ) != string::npos ) return ENTRY;
+  return OTHER;
+}
+
+const char *httpStats::className( enum endpointClass cls ) {
+  switch( cls ) {
+    case FEED: return "feed";
+    case ENTRY: return "entry";
+    case MEDIA_DOWNLOAD: return "media download";
+    case UPLOAD: return "upload";
+    default: return "other";
+  }
+}
+
+const char *httpStats::phaseName( enum phase ph ) {
+  switch( ph ) {
+    case DNS: return "dns";
+    case CONNECT: return "connect";
+    case TLS: return "tls";
+    case WAIT: return "wait";
+    case TRANSFER: return "transfer";
+    default: return "total";
+  }
+}
+
+string httpStats::toString() {
+  stringstream os;
+  boost::mutex::scoped_lock l(stats_mutex);
+  os << "Times in ms; percentiles are bucket upper bounds, buckets are <1,<2,<4,... ms\n";
+  for( int c = 0; c < NUM_CLASSES; c++ ) {
+    const struct classStats &s = stats[c];
+    os << "\n[" << className( (enum endpointClass) c ) << "]\n";
+    os << " requests: " << s.requests << " errors: " << s.errors
+       << " bytes down: " << (unsigned long long) s.bytesDown << " bytes up: " << (unsigned long long) s.bytesUp << "\n";
+    if ( s.requests == 0 ) continue;
+    for( int p = 0; p < NUM_PHASES; p++ ) {
+      os << " " << setw(9) << left << phaseName( (enum phase) p ) << right
+	 << " mean " << setw(8) << fixed << setprecision(1) << s.sum[p] / s.requests
+	 << " p50 " << setw(6) << percentile( s.histogram[p], s.requests, 50 )
+	 << " p95 " << setw(6) << percentile( s.histogram[p], s.requests, 95 )
+	 << " p99 " << setw(6) << percentile( s.histogram[p], s.requests, 99 )
+	 << " |";
+      for( int b = 0; b < NUM_BUCKETS; b++ ) os << " " << s.histogram[p][b];
+      os << "\n";
+    }
+  }
+  return os.str();
+}
+
+void httpStats::clear() {
+  boost::mutex::scoped_lock l(stats_mutex);
+  memset( stats, 0, sizeof( stats ) );
+}
@@ -0,0 +1,63 @@
+#ifndef _httpStats_H
+#define _httpStats_H
+
+/***************************************************************
+ * httpStats.h
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description: Aggregates the timing breakdown of finished HTTP
+ *              requests into per endpoint class histograms with
+ *              power of two millisecond buckets.
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+class httpStats {
+	public:
+		enum endpointClass { FEED, ENTRY, MEDIA_DOWNLOAD, UPLOAD, OTHER, NUM_CLASSES };
+		/* The phases are disjoint: DNS lookup, TCP connect, TLS handshake,
+		 * waiting for the first byte (server think time), transfer of
+		 * the body and the total time of the request. */
+		enum phase { DNS, CONNECT, TLS, WAIT, TRANSFER, TOTAL, NUM_PHASES };
+
+		/* Bucket i counts samples below 2^i ms, the last one everything above */
+		static const int NUM_BUCKETS = 16;
+
+		struct timing {
+			double nameLookup, connect, appConnect, startTransfer, total; // cumulative, in seconds (as reported by curl)
+			double bytesDown, bytesUp;
+		};
+
+	private:
+		struct classStats {
+			unsigned long requests, errors;
+			double bytesDown, bytesUp;
+			double sum[NUM_PHASES];
+			unsigned long histogram[NUM_PHASES][NUM_BUCKETS];
+		};
+
+		static boost::mutex stats_mutex;
+		static struct classStats stats[NUM_CLASSES];
+
+		static int bucket( double ms );
+		static double percentile( const unsigned long *histogram, unsigned long count, int pct );
+
+	public:
+		static void record( enum endpointClass cls, const struct timing &t, bool error );
+		static enum endpointClass classifyURL( const std::string &URL );
+		static const char *className( enum endpointClass cls );
+		static const char *phaseName( enum phase ph );
+		static std::string toString();
+		static void clear();
+};
+
+
+#endif /* _httpStats_H */
@@ -0,0 +1,170 @@
+/***************************************************************
+ * jpegHeader.cpp
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description:
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include "jpegHeader.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <vector>
+
+using namespace std;
+
+/* Markers */
+static const unsigned char M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_COM = 0xFE, M_APP1 = 0xE1;
+
+/* EXIF tags */
+static const unsigned short T_DESCRIPTION = 0x010E, T_ORIENTATION = 0x0112, T_EXIF_IFD = 0x8769, T_DATETIME_ORIGINAL = 0x9003;
+
+static const char EXIF_ID[] = "Exif\0\0";
+static const char XMP_ID[] = "http://ns.adobe.com/xap/1.0/";
+
+
+/* The header is read in growing chunks, it is nearly always in the
+ * first one. Files which do not reach their image data within the
+ * limit are parsed as far as they were read. */
+static const size_t FIRST_CHUNK = 64*1024, MAX_HEADER = 16*1024*1024;
+
+jpegHeader::jpegHeader(): valid(false), incomplete(false), orientation(1), width(0), height(0) {
+}
+
+bool jpegHeader::load( const string &fileName ) {
+  int fd = open( fileName.c_str(), O_RDONLY );
+  if ( fd < 0 ) return false;
+  vector<char> buf;
+  size_t got = 0;
+  bool eof = false;
+  for( size_t want = FIRST_CHUNK; ; want *= 4 ) {
+    if ( want > MAX_HEADER ) want = MAX_HEADER;
+    buf.resize( want );
+    while( got < want ) {
+      ssize_t r = pread( fd, &buf[got], want - got, got );
+      if ( r < 0 && errno == EINTR ) continue;
+      if ( r <= 0 ) {
+	eof = true;
+	break;
+      }
+      got += r;
+    }
+    *this = jpegHeader();
+    parse( &buf[0], got );
+    if ( ! incomplete || eof || want == MAX_HEADER ) break;
+  }
+  close( fd );
+  return valid;
+}
+
+static bool isSOF( unsigned char m ) {
+  return ( m >= 0xC0 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC );
+}
+
+bool jpegHeader::parse( const char *data, size_t len ) {
+  const unsigned char *d = (const unsigned char *) data;
+  valid = false;
+  if ( len < 4 || d[0] != 0xFF || d[1] != M_SOI ) return false;
+  valid = true;
+  size_t pos = 2;
+  incomplete = true; // until the image data is reached
+  while( pos < len ) {
+    // Markers start with 0xFF, possibly preceded by more 0xFF fill bytes
+    const unsigned char *ff = (const unsigned char *) memchr( d + pos, 0xFF, len - pos );
+    if ( ff == NULL ) break;
+    pos = ff - d;
+    while( pos < len && d[pos] == 0xFF ) pos++;
+    if ( pos >= len ) break;
+    unsigned char m = d[pos++];
+    if ( m == 0 || m == 0x01 || m == M_SOI || ( m >= 0xD0 && m <= 0xD7 ) ) continue; // no length field
+    if ( m == M_EOI || m == M_SOS ) { // image data follows, no more metadata
+      incomplete = false;
+      break;
+    }
+    if ( pos + 2 > len ) break;
+    size_t segLen = ( d[pos] << 8 ) | d[pos+1];
+    if ( segLen < 2 ) {
+      incomplete = false; // corrupt, reading on would not help
+      break;
+    }
+    if ( pos + segLen > len ) break;
+    const unsigned char *seg = d + pos + 2;
+    size_t payload = segLen - 2;
+    if ( m == M_COM ) {
+      comment.assign( (const char *) seg, payload );
+      string::size_type end = comment.find_last_not_of( '\0' );
+      comment.erase( end == string::npos ? 0 : end + 1 );
+    } else if ( m == M_APP1 && payload >= sizeof(EXIF_ID)-1 && memcmp( seg, EXIF_ID, sizeof(EXIF_ID)-1 ) == 0 ) {
+      parseExif( seg + sizeof(EXIF_ID)-1, payload - (sizeof(EXIF_ID)-1) );
+    } else if ( m == M_APP1 && payload >= sizeof(XMP_ID) && memcmp( seg, XMP_ID, sizeof(XMP_ID) ) == 0 ) {
+      if ( description == "" ) parseXMP( (const char *) seg + sizeof(XMP_ID), payload - sizeof(XMP_ID) );
+    } else if ( isSOF( m ) && payload >= 5 ) {
+      height = ( seg[1] << 8 ) | seg[2];
+      width = ( seg[3] << 8 ) | seg[4];
+    }
+    pos += segLen;
+  }
+  return valid;
+}
+
+/* Reads the TIFF structure inside the EXIF segment: IFD0 and the EXIF sub-IFD */
+void jpegHeader::parseExif( const unsigned char *p, size_t len ) {
+  if ( len < 8 ) return;
+  bool le;
+  if ( p[0] == 'I' && p[1] == 'I' ) le = true;
+  else if ( p[0] == 'M' && p[1] == 'M' ) le = false;
+  else return;
+  #define RD16(o) ( le ? ( p[o] | ( p[(o)+1] << 8 ) ) : ( ( p[o] << 8 ) | p[(o)+1] ) )
+  #define RD32(o) ( le ? ( (unsigned long) RD16(o) | ( (unsigned long) RD16((o)+2) << 16 ) ) : ( ( (unsigned long) RD16(o) << 16 ) | (unsigned long) RD16((o)+2) ) )
+
+  unsigned long ifds[2] = { RD32(4), 0 };
+  for( int i = 0; i < 2 && ifds[i] != 0; i++ ) {
+    unsigned long ifd = ifds[i];
+    if ( ifd + 2 > len ) return;
+    unsigned int count = RD16( ifd );
+    for( unsigned int e = 0; e < count; e++ ) {
+      size_t entry = ifd + 2 + e*12;
+      if ( entry + 12 > len ) return;
+      unsigned short tag = RD16( entry ), type = RD16( entry + 2 );
+      unsigned long n = RD32( entry + 4 );
+      if ( tag == T_ORIENTATION && type == 3 ) {
+	orientation = RD16( entry + 8 );
+      } else if ( tag == T_EXIF_IFD && i == 0 ) {
+	ifds[1] = RD32( entry + 8 );
+      } else if ( ( tag == T_DESCRIPTION || tag == T_DATETIME_ORIGINAL ) && type == 2 ) {
+	// ASCII values longer than 4 bytes are stored at an offset
+	size_t off = ( n > 4 ) ? RD32( entry + 8 ) : entry + 8;
+	if ( off + n > len ) continue;
+	string val( (const char *) p + off, n );
+	string::size_type end = val.find_last_not_of( string( "\0 ", 2 ) );
+	val.erase( end == string::npos ? 0 : end + 1 );
+	if ( tag == T_DESCRIPTION ) description = val;
+	else captureTime = val;
+      }
+    }
+  }
+  #undef RD16
+  #undef RD32
+}
+
+/* Extracts the (first) dc:description alternative from an XMP packet */
+void jpegHeader::parseXMP( const char *p, size_t len ) {
+  string xmp( p, len );
+  string::size_type pos = xmp.find( "<dc:description" );
+  if ( pos == string::npos ) return;
+  pos = xmp.find( "<rdf:li", pos );
+  if ( pos == string::npos ) return;
+  pos = xmp.find( '>', pos );
+  if ( pos == string::npos ) return;
+  string::size_type end = xmp.find( "</rdf:li>", pos );
+  if ( end == string::npos ) return;
+  description = xmp.substr( pos + 1, end - pos - 1 );
+}
@@ -0,0 +1,54 @@
+#ifndef _jpegHeader_H
+#define _jpegHeader_H
+
+/***************************************************************
+ * jpegHeader.h
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description: Reads the metadata of a JPEG file (comment, EXIF
+ *              orientation, description and capture time, XMP
+ *              description, dimensions) from the marker segments
+ *              preceding the image data, without decoding any pixels.
+ * Usage:
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include <string>
+
+
+class jpegHeader {
+	private:
+		bool valid;
+		bool incomplete; // the data ended before the image data started
+		std::string comment, description, captureTime;
+		int orientation, width, height;
+
+		void parseExif( const unsigned char *p, size_t len );
+		void parseXMP( const char *p, size_t len );
+
+	public:
+		jpegHeader();
+
+		/* Both return false if the data does not look like a JPEG file */
+		bool parse( const char *data, size_t len );
+		bool load( const std::string &fileName );
+
+		bool isValid() const { return valid; };
+		// The contents of the COM segment (what ImageMagick calls the "comment" attribute)
+		const std::string &getComment() const { return comment; };
+		// EXIF ImageDescription, or the XMP dc:description if there is none
+		const std::string &getDescription() const { return description; };
+		// EXIF DateTimeOriginal ("YYYY:MM:DD HH:MM:SS") or ""
+		const std::string &getCaptureTime() const { return captureTime; };
+		// EXIF orientation (1-8), 1 if not present
+		int getOrientation() const { return orientation; };
+		int getWidth() const { return width; };
+		int getHeight() const { return height; };
+};
+
+
+#endif /* _jpegHeader_H */
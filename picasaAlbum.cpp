@@ -22,10 +22,12 @@
 #include "ticpp/ticpp.h"
 
 #include <iostream>
+#include <boost/bind.hpp>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stdlib.h>
 
 
 using namespace std;
@@ -121,6 +123,14 @@ string picasaAlbum::getUser() const {
   return selfURL.substr(userSPos, userEPos-userSPos );
 }
   
+long picasaAlbum::getNumPhotos() const {
+  try {
+    return atol( xml->FirstChildElement()->FirstChildElement("gphoto:numphotos")->GetText(false).c_str() );
+  } catch ( ticpp::Exception &ex ) {
+    return -1;
+  }
+}
+
 enum picasaAlbum::accessType picasaAlbum::getAccessType() const { 
   string acSTR=xml->FirstChildElement()->FirstChildElement("gphoto:access")->GetText(false);
   if ( acSTR == "private" ) return UNLISTED;
@@ -135,7 +145,19 @@ void picasaAlbum::setLocation( string location ) {
    addOrSet( xml->FirstChildElement(), "gphoto:location", location );
 }
 
-list<picasaPhotoPtr> picasaAlbum::getPhotos() {
+void picasaAlbum::streamedPhoto( photoCallback cb, atomEntryPtr entry ) {
+  picasaPhotoPtr ph( new picasaPhoto( *entry ) );
+  cb( ph );
+}
+
+const string picasaAlbum::listingFields =
+	"openSearch:totalResults,link,"
+	"entry(@gd:etag,title,summary,updated,published,link,content,category,"
+	      "gphoto:id,gphoto:albumid,gphoto:size,gphoto:timestamp,gphoto:version)";
+
+const string picasaAlbum::titleFields = "openSearch:totalResults,link,entry(title)";
+
+bool picasaAlbum::streamPhotos( photoCallback cb, const string &fields, time_t updatedMin ) {
   atomFeed photoFeed( api );
   string URL = selfURL;
   URL.replace(selfURL.find("entry"), 5, "feed");
@@ -143,13 +165,17 @@ list<picasaPhotoPtr> picasaAlbum::getPhotos() {
     URL+="&kind=photo";
   else 
     URL+="?kind=photo";
-  photoFeed.loadFromURL(URL);
-  list<atomEntryPtr> entries = photoFeed.getEntries();
+  if ( updatedMin != 0 ) URL+="&updated-min="+formatTime( updatedMin );
+  return photoFeed.streamPagedEntries( URL, boost::bind( &picasaAlbum::streamedPhoto, cb, _1 ), fields );
+}
+
+static void collectPhoto( list<picasaPhotoPtr> *photos, picasaPhotoPtr photo ) {
+  photos->push_back( photo );
+}
+
+list<picasaPhotoPtr> picasaAlbum::getPhotos() {
   list<picasaPhotoPtr> photos;
-  for( list<atomEntryPtr>::iterator it=entries.begin();it !=entries.end();it++) {
-    picasaPhotoPtr ph( new picasaPhoto( **it ) );
-    photos.push_back( ph );
-  }
+  streamPhotos( boost::bind( collectPhoto, &photos, _1 ) );
   return photos;
 }
 
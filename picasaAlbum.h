@@ -17,7 +17,9 @@
 #include <string>
 #include <list>
 #include <iosfwd>
+#include <time.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
 
 class picasaPhoto;
 class picasaAlbum;
@@ -26,11 +28,15 @@ typedef boost::shared_ptr<picasaPhoto> picasaPhotoPtr;
 typedef boost::shared_ptr<picasaAlbum> picasaAlbumPtr;
 
 #include "atomEntry.h"
+#include "atomFeed.h"
 
 class picasaAlbum : public atomEntry {
 	public:
 		enum accessType { PUBLIC, UNLISTED, ACL };
+		typedef boost::function<void (picasaPhotoPtr)> photoCallback;
 
+	private:
+		static void streamedPhoto( photoCallback cb, atomEntryPtr entry );
 
 	protected:
 		picasaAlbum( gAPI* api, const std::string& xml = "" );
@@ -56,6 +62,18 @@ class picasaAlbum : public atomEntry {
 		picasaPhotoPtr addPhoto( const std::string &fileName, const std::string &Summary = "", const std::string &Title = ""   ) throw ( enum atomObj::exceptionType );
 
 		std::list<picasaPhotoPtr> getPhotos();
+		/* Calls cb with each photo of the album while the photo feed is being
+		 * downloaded, returns false if it could not be downloaded completely.
+		 * If fields is not empty, only those elements are requested (see
+		 * atomFeed::streamEntries). If updatedMin is not 0, only the photos
+		 * updated since then are listed. */
+		bool streamPhotos( photoCallback cb, const std::string &fields = "", time_t updatedMin = 0 );
+		// What the cache needs to know about a photo to list it
+		static const std::string listingFields;
+		// Just enough to tell which photos are in the album
+		static const std::string titleFields;
+		// The number of photos in the album according to the album entry, -1 if not known
+		long getNumPhotos() const;
 
 		friend class picasaService;
 		friend std::ostream &operator<<(std::ostream &out, const picasaAlbum &album);
@@ -24,6 +24,8 @@
 
 #include "convert.h"
 #include "curlRequest.h"
+#include "httpStats.h"
+#include "bufferPool.h"
 
 
 #include <boost/bind.hpp>
@@ -41,7 +43,9 @@
 #include <fstream>
 
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 
@@ -92,8 +96,12 @@ const struct cacheElement &cacheElement::operator=( const struct cacheElement &e
     world_readable = e.world_readable;
     writeable = e.writeable;
     last_updated = e.last_updated;
+    mtime = e.mtime;
+    ctime = e.ctime;
     localChanges = e.localChanges;
+    pinned = e.pinned;
     xmlRepresentation = e.xmlRepresentation;
+    partial = e.partial;
     cachedVersion = e.cachedVersion;
     picasaObj = e.picasaObj;
     finalized = e.finalized;
@@ -101,6 +109,8 @@ const struct cacheElement &cacheElement::operator=( const struct cacheElement &e
 	    case cacheElement::DIRECTORY:
 		    authKey = e.authKey;
 		    contents = e.contents;
+		    synced = e.synced;
+		    remotePhotos = e.remotePhotos;
 		    return e;
 	    case cacheElement::FILE:
 	            authKey   = "";
@@ -109,6 +119,8 @@ const struct cacheElement &cacheElement::operator=( const struct cacheElement &e
 		    read_fd = e.read_fd;
 		    write_fd = e.write_fd;
 		    numOfOpenWr = e.numOfOpenWr;
+		    prepared = e.prepared;
+		    uploadSummary = e.uploadSummary;
 		    return e;
     }
     return e;
@@ -125,12 +137,14 @@ ostream &operator<<(ostream &out, const cacheElement &e ) {
       out << "Type: Directory " << endl;
       out << "AuthKey: " << e.authKey << endl;
       out << "Contents Size: " << e.contents.size() << endl;
+      out << "Synchronized: " << e.synced << " (" << e.remotePhotos << " photos on the server)" << endl;
       break;
     case cacheElement::FILE:
       out << "Type: File " << endl;
       out << "CachePath: " << e.cachePath << endl;
       break;
   }
+  if ( e.partial ) out << "Partial entry (from a listing)" << endl;
   out << " ---------- XML ------------ " << endl;
   out << e.xmlRepresentation << endl;
   out << " --------------------------- " << endl;
@@ -145,6 +159,7 @@ void cacheElement::buildPicasaObj(picasaService* picasa) {
       return;
     case cacheElement::FILE:
       picasaObj = picasa->photoFromXML( xmlRepresentation );
+      if ( picasaObj ) picasaObj->setPartial( partial );
       return;
   }
 }
@@ -161,10 +176,22 @@ void cacheElement::fromAlbum(picasaAlbumPtr album) {
 //  contents.clear();
   localChanges = false;
   xmlRepresentation = album->getStringXML();
+  partial = album->isPartial();
+  timesFromEntry( *album );
   // if ( picasaObj != album )  delete picasaObj;
   picasaObj = album;
 }
 
+/* The modification time is when the entry was last updated on the server,
+ * falling back to the date of the photo/album and to the publishing time */
+void cacheElement::timesFromEntry( const atomEntry &entry ) {
+  time_t updated = entry.getTime( "updated" ), published = entry.getTime( "published" );
+  mtime = updated;
+  if ( mtime == 0 ) mtime = entry.getTime( "gphoto:timestamp" );
+  if ( mtime == 0 ) mtime = published;
+  ctime = ( published != 0 ) ? published : mtime;
+}
+
 void cacheElement::fromPhoto(picasaPhotoPtr photo) {
   type = cacheElement::FILE;
   name = photo->getTitle();
@@ -176,6 +203,8 @@ void cacheElement::fromPhoto(picasaPhotoPtr photo) {
   contents.clear();
   localChanges = false;
   xmlRepresentation = photo->getStringXML();
+  partial = photo->isPartial();
+  timesFromEntry( *photo );
   // if ( picasaObj != photo ) delete picasaObj;
   picasaObj = photo;
   generated = false;
@@ -203,10 +232,12 @@ const pathParser picasaCache::onlinePath(".control/online");
 const pathParser picasaCache::helpPath(".control/help");
 const pathParser picasaCache::logPath(".control/log");
 const pathParser picasaCache::statsPath( ".control/stats" );
+const pathParser picasaCache::httpStatsPath( ".control/http_stats" );
 const pathParser picasaCache::authKeysPath( ".control/auth_keys" );
 const pathParser picasaCache::updateQueuePath(".control/update_queue");
 const pathParser picasaCache::priorityQueuePath(".control/priority_queue");
 const pathParser picasaCache::localChangesQueuePath(".control/local_changes_queue");
+const pathParser picasaCache::pinnedPath(".control/pinned");
 
 const string help_text = "PicasaFUSE help\n"
 			 "\n"
@@ -214,11 +245,15 @@ const string help_text = "PicasaFUSE help\n"
 			 "   help			... this file\n"
 			 "   log			... the log file\n"
 			 "   status			... a file containing some statistics about the filesystem\n"
+			 "   http_stats			... timing histograms (dns, connect, tls, wait, transfer) of the HTTP\n"
+			 "				    requests, split by feed/entry/media download/upload\n"
 			 "   auth_keys			... a file containing album name = authkey pairs (for backup purposes)\n"
 			 "   update_queue		... files waiting to be updated\n"
 			 "   priority_update_queue	... files which will be updated with precedence (usually photos\n"
 			 "				    which some application tried to read but which were not yet downloaded\n"
 			 "   local_changes_queue	... albums/photos with local changes waiting to be updated on the server\n"
+			 "				    (photos currently being resized or uploaded are marked as such)\n"
+			 "   pinned			... pinned albums/photos and how much of them is already downloaded\n"
 			 "\n"
 			 " How to achieve ...\n"
 			 "   Q: How to cache some users albums?\n"
@@ -250,6 +285,21 @@ const string help_text = "PicasaFUSE help\n"
 			 ""
 			 "   Q: How to enable networking?\n"
 			 "   A: touch .control/online\n"
+			 "      Failed requests are retried automatically and if the server stays unreachable\n"
+			 "      network operations are suspended and resumed once it answers again, so this\n"
+			 "      is only needed after touching .control/offline.\n"
+			 "\n"
+			 "   Q: How to make sure an album is available offline?\n"
+			 "   A: setfattr -n user.Pinned -v 1 album_dir\n"
+			 "      All its photos are downloaded in the background (see .control/pinned) and are\n"
+			 "      never deleted to make room for others. To unpin it use\n"
+			 "      setfattr -x user.Pinned album_dir. Single photos may be pinned the same way.\n"
+			 "\n"
+			 "   Q: How to limit the disk space used by the cached photos?\n"
+			 "   A: Mount with -o cache-size=N (in Mb). Least useful photos are deleted when the limit\n"
+			 "      is exceeded (photos read once go before photos read repeatedly) and downloaded\n"
+			 "      again when needed. Photos with local changes are never deleted. df on the\n"
+			 "      mountpoint shows the limit and its use.\n"
 			 "\n"
 			 "   Advanced operations...\n"
 			 "\n"
@@ -260,7 +310,14 @@ const string help_text = "PicasaFUSE help\n"
 picasaCache::picasaCache( picasaConfig &cf ):
 	conf(cf),
 	work_to_do(false), kill_thread(false), cacheDir( cf.getCacheDir() ), updateInterval(cf.getUpdateInterval()),
-	numOfPixels( cf.getMaxPixels() ), maxJobThreads( 10 ), haveNetworkConnection(true),num_of_open_fds(0),
+	numOfPixels( cf.getMaxPixels() ), maxJobThreads( 10 ), haveNetworkConnection(true),last_login_attempt(0),login_pending(false),num_of_open_fds(0),picasa(NULL),
+	resizeWorkers( cf.getResizeWorkers() ), uploadWorkers( cf.getUploadWorkers() ),
+	prepare_queue( 4*cf.getResizeWorkers() ), upload_queue( 2*cf.getUploadWorkers() ),
+	budget( (unsigned long long) cf.getCacheSize() * 1024 * 1024 ), evicted_count( 0 ),
+	prefetchWorkers( 2 ), prefetch_queue( 2*prefetchWorkers ), prefetched_count( 0 ), prefetch_failed_count( 0 ),
+	readahead_count( 0 ), readahead_hits( 0 ), readahead_late( 0 ),
+	negative_count( 0 ), negative_hits( 0 ), coalesced_count( 0 ),
+	staleWhileRevalidate( cf.getStaleWhileRevalidate() ), foreground_timeouts( 0 ),
 #ifdef DEBUG
 	logThreshold(LOG_DEBUG)
 #else
@@ -268,50 +325,109 @@ picasaCache::picasaCache( picasaConfig &cf ):
 #endif
 {
   api = new gAPI( cf.getUser(), "picasaFUSE" );
-  if ( cf.getOffline() ) {
-    haveNetworkConnection = false;
-  } else goOnline();
+  api->setTokenFile( cacheDir + "/.auth_token" );
+  curlRequest::hedgingEnabled = cf.getHedgeRequests();
+  curlRequest::setDeadline( curlRequest::FOREGROUND_METADATA, cf.getMetadataTimeout() );
+  curlRequest::setDeadline( curlRequest::FOREGROUND_READ, cf.getReadTimeout() );
+  curlRequest::setDeadline( curlRequest::BACKGROUND, cf.getRefreshTimeout() );
+  curlRequest::setDeadline( curlRequest::UPLOAD, cf.getUploadTimeout() );
+  if ( cf.getOffline() ) haveNetworkConnection = false;
 
   picasa = new picasaService( api );
+  startPipeline();
 
   mkdir( cacheDir.c_str(), 0755 );
   string cacheFName = cacheDir + "/.cache", err;
+  bool loaded = false;
   if ( boost::filesystem::exists( cacheFName ) ) {
     try {
       std::ifstream ifs(cacheFName.c_str(), ios::binary );
       boost::archive::text_iarchive ia(ifs);
       ia >> cache;
       insertControlDir();
-      return;
+      initCacheBudget();
+      loaded = true;
     } catch ( boost::archive::archive_exception ex ) {
       err = ex.what();
       cache.clear();
     }
   }
-  createRootDir();
-  insertControlDir();
-  if ( err != "" ) LOG( LOG_ERROR, "Error reading cache from disk ("+err+")" );
-  LOG( LOG_NOTICE, "New cache created");
+  if ( ! loaded ) {
+    createRootDir();
+    insertControlDir();
+    if ( err != "" ) LOG( LOG_ERROR, "Error reading cache from disk ("+err+")" );
+    LOG( LOG_NOTICE, "New cache created");
+  }
+  // The mount is served from the cache at once, connecting and logging in happens in the background
+  if ( haveNetworkConnection ) goOnline();
 }
 
 bool picasaCache::goOffLine() {
   LOG( LOG_NOTICE, "Suspending network operations." );
   haveNetworkConnection = false;
+  return true;
 }
 
+/*
+ * Only starts checking the connection and logging in (in connect_thread),
+ * operations which need to be logged in wait for it in waitForLogin().
+ */
 bool picasaCache::goOnline() {
   LOG( LOG_NOTICE, "Trying to resume network operations." );
-  haveNetworkConnection = api->checkNetworkConnection();
-  if ( ! haveNetworkConnection ) LOG( LOG_ERROR, "Network seems to be down." );
-  if ( haveNetworkConnection && ! api->loggedIn() ) {
-    try {
-      api->login( conf.getPass() );
-    } catch ( gAPI::exceptionType ex ) {
-      LOG( LOG_ERROR, "Could not login to picasa" );
-      if ( ex == gAPI::NO_NETWORK_CONNECTION ) haveNetworkConnection = false;
-    }
+  haveNetworkConnection = true;
+  curlRequest::breaker.reset();
+  boost::mutex::scoped_lock l(login_mutex);
+  if ( login_pending ) return true; // Already connecting
+  login_pending = true;
+  if ( connect_thread ) connect_thread->join();
+  connect_thread = boost::shared_ptr<boost::thread>( new boost::thread( boost::bind( &picasaCache::connect_worker, this ) ) );
+  return true;
+}
+
+void picasaCache::connect_worker() {
+  curlRequest::deadlineScope ds( curlRequest::FOREGROUND_METADATA ); // Somebody may be waiting in waitForLogin()
+  if ( ! api->checkNetworkConnection() ) LOG( LOG_ERROR, "Network seems to be down." );
+  last_login_attempt = 0;
+  tryLogin();
+  {
+    boost::mutex::scoped_lock l(login_mutex);
+    login_pending = false;
+    login_done.notify_all();
+  }
+  LOG( LOG_NOTICE, string( "Network operations resumed, " ) + ( api->loggedIn() ? "logged in." : "not logged in." ) );
+  resumePrefetch();
+}
+
+/*
+ * Waits until goOnline() finished connecting. Updates must not run before,
+ * the users own feeds would be fetched without the private albums.
+ */
+void picasaCache::waitForLogin() {
+  boost::mutex::scoped_lock l(login_mutex);
+  // The workers are woken up by interrupts, they must not abort the wait
+  boost::this_thread::disable_interruption di;
+  while( login_pending ) login_done.wait( l );
+}
+
+bool picasaCache::networkAvailable() const {
+  return ( haveNetworkConnection && curlRequest::networkAvailable() );
+}
+
+/*
+ * Logs in if we have credentials and are not logged in yet. Failed attempts
+ * are repeated at most once a minute (e.g. when the network comes back).
+ */
+void picasaCache::tryLogin() {
+  if ( api->loggedIn() || conf.getUser() == "" ) return;
+  if ( ! networkAvailable() ) return;
+  time_t now = time( NULL );
+  if ( now - last_login_attempt < 60 ) return;
+  last_login_attempt = now;
+  try {
+    if ( ! api->login( conf.getPass() ) ) LOG( LOG_ERROR, "Could not login to picasa" );
+  } catch ( gAPI::exceptionType ex ) {
+    LOG( LOG_ERROR, "Could not login to picasa" );
   }
-  return haveNetworkConnection;
 }
 
 string picasaCache::toString() {
@@ -378,7 +494,9 @@ void picasaCache::insertControlDir() {
   insertSpecialFile( updateQueuePath );
   insertSpecialFile( localChangesQueuePath );
   insertSpecialFile( statsPath );
+  insertSpecialFile( httpStatsPath );
   insertSpecialFile( authKeysPath );
+  insertSpecialFile( pinnedPath );
   insertSpecialFile( helpPath );
   cacheElement c;
   getFromCache( helpPath, c );
@@ -421,6 +539,11 @@ void picasaCache::updateLCQueueFile() {
   for( std::list<pathParser>::const_iterator it = local_change_queue.begin(); it != local_change_queue.end(); ++it ) {
     os << it->getFullName() << endl;
   }
+  l.unlock();
+  boost::mutex::scoped_lock pl(in_pipeline_mutex);
+  for( std::set<pathParser>::const_iterator it = in_pipeline.begin(); it != in_pipeline.end(); ++it ) {
+    os << it->getFullName() << " (uploading)" << endl;
+  }
   e.cachePath=os.str();
   e.size = e.cachePath.size();
   putIntoCache( localChangesQueuePath, e );
@@ -436,11 +559,43 @@ void picasaCache::updateStatsFile() {
   os << "Update Queue size:" << update_queue.size() << endl; lu.unlock();
   os << "Priority Queue size:" << priority_update_queue.size() << endl; lp.unlock();
   os << "Local Changes Queue size:" << local_change_queue.size() << endl; lc.unlock();
+  os << "Photo cache: " << budget << ", evicted " << evicted_count << " files" << endl;
+  {
+    boost::mutex::scoped_lock rl(readahead_mutex);
+    os << "Read-ahead: " << readahead_count << " photos queued, " << readahead_hits << " hits, " << readahead_late << " not ready when opened";
+    if ( readahead_count > 0 ) os << " (hit rate " << ( 100 * readahead_hits ) / readahead_count << "%)";
+    os << endl;
+  }
+  {
+    boost::mutex::scoped_lock nl(negative_mutex);
+    os << "Negative lookups: " << negative_count << " cached, " << negative_hits << " answered without network" << endl;
+  }
+  {
+    boost::mutex::scoped_lock fl(in_flight_mutex);
+    os << "Updates in flight: " << in_flight.size() << ", " << coalesced_count << " concurrent requests coalesced, "
+       << foreground_timeouts << " not finished within the deadline" << endl;
+  }
+  os << "Upload pipeline: " << prepare_queue.size() << " waiting for resize, " << upload_queue.size() << " waiting for upload ("
+     << resizeWorkers << " resize / " << uploadWorkers << " upload workers)" << endl;
   os << "Network connection:";
-  if ( haveNetworkConnection ) os <<"online";
-  else os << "offline";
+  if ( ! haveNetworkConnection ) os << "offline (by request)";
+  else if ( networkAvailable() ) os <<"online";
+  else os << "offline (API host unreachable)";
   os<<std::endl;
+  os << "API host circuit:" << curlRequest::breaker << endl;
+  os << "Request retries:" << curlRequest::retries_count << endl;
+  os << "Request timeouts:" << curlRequest::timeouts_count << " (deadlines:";
+  for( int i = 0; i < curlRequest::NUM_DEADLINE_CLASSES; i++ ) {
+    enum curlRequest::deadlineClass cls = (enum curlRequest::deadlineClass) i;
+    os << " " << curlRequest::deadlineClassName( cls ) << " ";
+    if ( curlRequest::getDeadline( cls ) > 0 ) os << curlRequest::getDeadline( cls ) << "s";
+    else os << "none";
+  }
+  os << ")" << endl;
+  os << "Hedged requests:" << curlRequest::hedges_count << " of " << curlRequest::hedgeable_count
+     << " (hedge won " << curlRequest::hedge_wins_count << ")" << endl;
   os << "CURL handles count:"<<curlRequest::handles_count << endl;
+  os << "Response buffers allocated:" << bufferPool::allocated_count << endl;
   os << "OPEN file descriptors:" << num_of_open_fds << endl;
   os << conf;
   e.cachePath=os.str();
@@ -448,6 +603,14 @@ void picasaCache::updateStatsFile() {
   putIntoCache( statsPath, e );
 }
 
+void picasaCache::updateHttpStatsFile() {
+  struct cacheElement e;
+  if ( ! getFromCache( httpStatsPath, e ) ) return;
+  e.cachePath = httpStats::toString();
+  e.size = e.cachePath.size();
+  putIntoCache( httpStatsPath, e );
+}
+
 void picasaCache::updateAuthKeys() {
   stringstream os;
   boost::mutex::scoped_lock l(cache_mutex);
@@ -472,10 +635,12 @@ void picasaCache::updateLogFile() {
 
 void picasaCache::updateSpecial(const pathParser p) {
   if ( p == statsPath ) updateStatsFile();
+  else if ( p == httpStatsPath ) updateHttpStatsFile();
   else if ( p == localChangesQueuePath ) updateLCQueueFile();
   else if ( p == updateQueuePath ) updateUQueueFile();
   else if ( p == priorityQueuePath ) updatePQueueFile();
   else if ( p == authKeysPath ) updateAuthKeys();
+  else if ( p == pinnedPath ) updatePinnedFile();
   else if ( p == logPath ) updateLogFile();
 }
 
@@ -491,6 +656,16 @@ bool picasaCache::isSpecial( const pathParser &p ) {
 
 picasaCache::~picasaCache() {
   kill_thread = true;
+  curlRequest::cancelAll(); // Do not wait for running transfers
+  if ( connect_thread ) connect_thread->join();
+  {
+    boost::mutex::scoped_lock l(prefetch_mutex);
+    prefetch_wanted.notify_all();
+  }
+  prepare_queue.close();
+  upload_queue.close();
+  prefetch_queue.close();
+  pipeline_threads.join_all();
   saveCacheToDisk();
   update_thread->interrupt();
   priority_update_thread->interrupt();
@@ -563,7 +738,7 @@ void picasaCache::localChange( const pathParser p ) {
   boost::mutex::scoped_lock l(local_change_queue_mutex);
   local_change_queue.push_back(p);
   l.unlock();
-  if ( haveNetworkConnection ) update_thread->interrupt();
+  if ( haveNetworkConnection && update_thread ) update_thread->interrupt();
 }
 
 
@@ -586,13 +761,12 @@ void picasaCache::newAlbum( const pathParser A ) throw ( enum picasaCache::excep
   getFromCache( A.chop(), c );
   c.contents.insert( album.getTitle() );
   putIntoCache( A.chop(), c );
-  if ( haveNetworkConnection ) {
+  if ( networkAvailable() ) {
     try {
       doUpdate( A );
     } catch ( gAPI::exceptionType ex ) {
       localChange(A);
       if ( ex == gAPI::NO_NETWORK_CONNECTION ) {
-	haveNetworkConnection = false;
 	LOG( LOG_WARN, "Error creating album "+A.getFullName()+" on Picasa: No network connection." );
       } else {
 	LOG( LOG_ERROR, "Error creating album "+A.getFullName()+" on Picasa." );
@@ -616,12 +790,11 @@ void picasaCache::pushAlbum( const pathParser A ) throw ( enum picasaCache::exce
   }
 
   picasaAlbumPtr album = boost::dynamic_pointer_cast<picasaAlbum,atomEntry>(c.picasaObj);
-  if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+  if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
   try {
     if ( ! album->PUSH_CHANGES() ) throw OPERATION_FAILED;
   } catch ( gAPI::exceptionType ex ) {
     if ( ex == gAPI::NO_NETWORK_CONNECTION ) {
-      haveNetworkConnection = false;
       LOG( LOG_WARN, "Error updating album "+A.getFullName()+" on Picasa: No network connection." );
       throw NO_NETWORK_CONNECTION;
     } else {
@@ -634,19 +807,86 @@ void picasaCache::pushAlbum( const pathParser A ) throw ( enum picasaCache::exce
 }
 
 
+static void collectTitle( set<string> *titles, picasaPhotoPtr photo ) {
+  titles->insert( photo->getTitle() );
+}
+
+// Called by updateAlbum for each photo in the feed of the album A
+void picasaCache::albumPhoto( const pathParser &A, cacheElement &c, set<string> &seen, bool &newPinned, picasaPhotoPtr photo ) {
+  cacheElement pElement;
+  string pName = photo->getTitle();
+  seen.insert( pName );
+  if ( c.contents.find( pName ) == c.contents.end() ) { // A new photo
+    pElement.fromPhoto( photo );
+    c.contents.insert( pName );
+    pElement.cachePath = A.getFullName()+"/"+pName;
+    pElement.pinned = c.pinned;
+    newPinned = ( newPinned || c.pinned );
+    putIntoCache( A + pName, pElement );
+    pleaseUpdate( A + pName );
+  } else { // photo already in cache
+    getFromCache( A + pName, pElement );
+    // A full entry which did not change since is better than the partial one from the listing
+    time_t updated = photo->getTime( "updated" );
+    if ( ! pElement.localChanges && ( pElement.partial || updated == 0 || pElement.mtime != updated ) ) {
+      pElement.fromPhoto( photo );
+      putIntoCache( A + pName, pElement );
+    }
+  }
+}
+
+/* The photos of album A (with contents c) which have an entry from the
+ * server, local photos not uploaded yet do not have one */
+long picasaCache::remotePhotoCount( const pathParser &A, const cacheElement &c ) {
+  long ret = 0;
+  boost::mutex::scoped_lock l(cache_mutex);
+  for( set<string>::const_iterator p = c.contents.begin(); p != c.contents.end(); ++p ) {
+    map<string, struct cacheElement>::iterator it = cache.find( ( A + *p ).getHash() );
+    if ( it != cache.end() && ! it->second.generated && it->second.xmlRepresentation != "" ) ret++;
+  }
+  return ret;
+}
+
+/* Replaces the partial entry of c (from a listing) by the full one,
+ * returns false if it could not be fetched */
+bool picasaCache::completeEntry( const pathParser &p, cacheElement &c ) {
+  if ( ! c.partial ) return true;
+  if ( c.type != cacheElement::FILE || ! networkAvailable() ) return false;
+  c.buildPicasaObj( picasa );
+  picasaPhotoPtr photo = boost::dynamic_pointer_cast<picasaPhoto,atomEntry>(c.picasaObj);
+  if ( ! photo ) return false;
+  try {
+    waitForLogin();
+    curlRequest::deadlineScope ds( curlRequest::FOREGROUND_METADATA );
+    if ( ! photo->PULL_CHANGES() ) return false;
+  } catch ( gAPI::exceptionType ex ) {
+    return false;
+  }
+  /* Only the entry is replaced. The element may have changed during the
+   * request (e.g. the file was opened), so c is not written back */
+  c.xmlRepresentation = photo->getStringXML();
+  c.partial = false;
+  boost::mutex::scoped_lock l(cache_mutex);
+  map<string, struct cacheElement>::iterator it = cache.find( p.getHash() );
+  if ( it == cache.end() ) return true; // removed meanwhile, c is still good for the caller
+  it->second.xmlRepresentation = c.xmlRepresentation;
+  it->second.partial = false;
+  it->second.picasaObj = c.picasaObj;
+  return true;
+}
+
 /*
  * Assumes A is already in the cache (or unlisted), otherwise throws
  */
 void picasaCache::updateAlbum( const pathParser A ) throw ( enum picasaCache::exceptionType ) {
   cacheElement c, pElement;
-  string pName;
   try {
   if ( ! getFromCache( A, c ) ) {
     int authKeyPos = A.getAlbum().find( "?authkey=" );
     if ( authKeyPos != string::npos ) { // Possibly an unlisted album, need not be in the cache
       string authKey = A.getAlbum().substr( authKeyPos+9 ),
              albumName = A.getAlbum().substr( 0, authKeyPos );
-      if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+      if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
       picasaAlbum album = picasa->getAlbumByName( albumName, A.getUser(), authKey );
       picasaAlbumPtr a( new picasaAlbum( album ) );
       c.fromAlbum( a );
@@ -682,7 +922,7 @@ void picasaCache::updateAlbum( const pathParser A ) throw ( enum picasaCache::ex
       removeFromCache( A );
       throw UNEXPECTED_ERROR;
   }
-  if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+  if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
   if ( ! album->PULL_CHANGES() ) {
     LOG( LOG_WARN, "Album "+A.getFullName()+" probably deleted on Picasa. Moving it to .lost_and_found/"+A.getAlbum() );
     lost_and_found(A);
@@ -701,50 +941,70 @@ void picasaCache::updateAlbum( const pathParser A ) throw ( enum picasaCache::ex
     putIntoCache( A.chop(), u );
   }
 
-  list<picasaPhotoPtr> photos = album->getPhotos();
-
+  /* New photos are added and known ones updated while the photo feed
+   * is still being downloaded. Only the elements the cache uses are
+   * requested, the rest is fetched by completeEntry when needed. Once the
+   * album was synchronized, only the photos updated since are listed. */
   set<string> photoTitles;
-  for( list<picasaPhotoPtr>::iterator p = photos.begin(); p != photos.end(); ++p )
-    photoTitles.insert( (*p)->getTitle() );
-
-  // Remove photos present in the album but not on picasa
-  // which have no local changes
-  set<string> toDelete;
-  // find candidates first
-  for( set<string>::iterator p = c.contents.begin(); p != c.contents.end(); ++p ) {
-    if ( photoTitles.find( *p ) == photoTitles.end() ) {
-      getFromCache( A + *p, pElement );
-      if ( ! pElement.localChanges ) toDelete.insert( *p );
+  bool newPinned = false, delta = ( c.synced != 0 );
+  time_t syncStart = time( NULL );
+  bool complete = album->streamPhotos( boost::bind( &picasaCache::albumPhoto, this, boost::cref( A ), boost::ref( c ), boost::ref( photoTitles ), boost::ref( newPinned ), _1 ),
+				       picasaAlbum::listingFields, delta ? c.synced - syncMargin : 0 );
+
+  if ( complete && delta ) {
+    /* Deleted photos are not in the delta. As long as the album has as many
+     * photos as we know of, nothing was deleted (or renamed), otherwise
+     * a listing of just the titles tells what is gone. */
+    c.remotePhotos = remotePhotoCount( A, c );
+    long numPhotos = album->getNumPhotos();
+    if ( numPhotos < 0 || numPhotos != c.remotePhotos ) {
+      LOG( LOG_NOTICE, "Photo count of "+A.getFullName()+" does not match, listing all of its photos." );
+      photoTitles.clear();
+      complete = album->streamPhotos( boost::bind( collectTitle, &photoTitles, _1 ), picasaAlbum::titleFields );
+      delta = false;
+      bool unknown = false;
+      for( set<string>::iterator t = photoTitles.begin(); t != photoTitles.end() && ! unknown; ++t )
+	unknown = ( c.contents.find( *t ) == c.contents.end() );
+      if ( complete && unknown ) {
+	// The delta missed photos, only a full listing brings them in
+	LOG( LOG_NOTICE, "Photos of "+A.getFullName()+" missing from the delta, synchronizing it again." );
+	c.synced = 0;
+	photoTitles.clear();
+	complete = album->streamPhotos( boost::bind( &picasaCache::albumPhoto, this, boost::cref( A ), boost::ref( c ), boost::ref( photoTitles ), boost::ref( newPinned ), _1 ),
+					picasaAlbum::listingFields, 0 );
+      }
     }
   }
-  // then remove them
-  for( set<string>::iterator p = toDelete.begin(); p != toDelete.end(); ++p ) {
-  	removeFromCache( A + *p );
-	c.contents.erase( *p );
-  }
 
-  // Add new photos and update old ones
-  for( list<picasaPhotoPtr>::iterator p = photos.begin(); p != photos.end(); ++p ) {
-    pName = (*p)->getTitle();
-    if ( c.contents.find( pName ) == c.contents.end() ) { // A new photo
-      pElement.fromPhoto( *p );
-      c.contents.insert( pName );
-      pElement.cachePath = A.getFullName()+"/"+pName;
-      putIntoCache( A + pName, pElement );
-      pleaseUpdate( A + pName );
-    } else { // photo already in cache
-      getFromCache( A + pName, pElement );
-      if ( ! pElement.localChanges ) {
-	pElement.fromPhoto( *p );
-	putIntoCache( A + pName, pElement );
+  if ( complete && ! delta ) {
+    // Remove photos present in the album but not on picasa
+    // which have no local changes
+    set<string> toDelete;
+    // find candidates first
+    for( set<string>::iterator p = c.contents.begin(); p != c.contents.end(); ++p ) {
+      if ( photoTitles.find( *p ) == photoTitles.end() ) {
+	getFromCache( A + *p, pElement );
+	if ( ! pElement.localChanges ) toDelete.insert( *p );
       }
     }
+    // then remove them
+    for( set<string>::iterator p = toDelete.begin(); p != toDelete.end(); ++p ) {
+	removeFromCache( A + *p );
+	c.contents.erase( *p );
+    }
+    c.remotePhotos = photoTitles.size();
+  }
+  if ( complete ) {
+    c.synced = syncStart;
+    c.last_updated = time( NULL );
+  } else {
+    // A photo missing from a truncated feed is not a deleted photo
+    LOG( LOG_WARN, "Could not get the complete list of photos in "+A.getFullName()+", will try again later." );
   }
-  c.last_updated = time( NULL );
   putIntoCache( A, c );
+  if ( newPinned ) schedulePrefetch( A );
   }  catch( gAPI::exceptionType ex ) {
     if ( ex == gAPI::NO_NETWORK_CONNECTION ) {
-      haveNetworkConnection = false;
       throw NO_NETWORK_CONNECTION;
     }   else throw OPERATION_FAILED;
   }
@@ -764,27 +1024,33 @@ void picasaCache::pushImage( const pathParser P ) throw ( enum picasaCache::exce
     if ( ! c.finalized ) {
       return;
     }
+    // Normally already done by the pipeline
+    if ( ! c.prepared ) {
+      preparePhoto( P );
+      if ( ! getFromCache( P, c ) ) throw OBJECT_DOES_NOT_EXIST;
+      if ( ! c.prepared ) return; // written to meanwhile, will be queued again on close
+    }
     c.buildPicasaObj( picasa );
     picasaPhotoPtr photo = boost::dynamic_pointer_cast<picasaPhoto,atomEntry>(c.picasaObj);
-    convert magic;
-    string summary = "";
+    string summary = c.uploadSummary;
+    if ( photo && c.partial ) {
+      // The entry is sent along with the image, it must not lose what the listing left out
+      if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
+      if ( ! photo->PULL_CHANGES() ) throw OPERATION_FAILED;
+      c.partial = false;
+    }
     if ( photo ) {
-      if ( numOfPixels > 0 ) {
-	magic.resize( numOfPixels, cacheDir + "/" + c.cachePath );
-      }
-      summary = magic.getComment( cacheDir + "/" + c.cachePath );
-      if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+      // The caption travels with the image data, no separate update needed
+      if ( summary != "" ) photo->setSummary( summary );
+      if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
       if ( ! photo->upload( cacheDir + "/" + c.cachePath ) ) {
 	LOG( LOG_ERROR, "Failed uploading "+ P.getFullName() + "to Picasa." );
 	throw OPERATION_FAILED;
       }
       c.localChanges = false;
+      c.prepared = false;
+      c.xmlRepresentation = photo->getStringXML();
       LOG( LOG_NOTICE, "Uploaded "+P.getFullName()+" to Picasa." );
-      if ( photo->getSummary() != summary && summary != "") {
-	photo->setSummary(summary);
-	if ( ! photo->UPDATE() ) c.localChanges = true;
-	LOG( LOG_ERROR, "Failed updating photo caption on "+P.getFullName()+"." );
-      }
     } else {
       cacheElement a;
       getFromCache( P.chop(), a );
@@ -794,15 +1060,12 @@ void picasaCache::pushImage( const pathParser P ) throw ( enum picasaCache::exce
 	LOG( LOG_CRIT, "Parent of photo "+P.getFullName()+" is not an album (or could not be reconstructed from xml).");
 	throw OPERATION_FAILED;
       }
-      if ( numOfPixels > 0 ) {
-	magic.resize( numOfPixels, cacheDir + "/" + c.cachePath );
-      }
-      summary = magic.getComment( cacheDir + "/" + c.cachePath );
-      if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+      if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
       try {
 	photo = album->addPhoto( cacheDir + "/" + c.cachePath, summary );
 	LOG( LOG_NOTICE, "Uploaded "+P.getFullName()+" to Picasa." );
 	c.fromPhoto( photo );
+	c.prepared = false;
 	c.last_updated = time( NULL );
 	pleaseUpdate( P.chop() );
       } catch ( atomObj::exceptionType &ex ) {
@@ -811,21 +1074,74 @@ void picasaCache::pushImage( const pathParser P ) throw ( enum picasaCache::exce
       }
     }
     putIntoCache( P, c );
+    trackBackingFile( P );
     return;
   }
   } catch( gAPI::exceptionType ex ) {
     if ( ex == gAPI::NO_NETWORK_CONNECTION ) {
-      haveNetworkConnection = false;
       throw NO_NETWORK_CONNECTION;
     } else throw OPERATION_FAILED;
   }
 }
 
+/*
+ * Resizes the photo and extracts its caption. This is done once per
+ * local change, an upload which is retried (or resumed) reuses the result.
+ */
+void picasaCache::preparePhoto( const pathParser P ) throw ( enum picasaCache::exceptionType ) {
+  cacheElement c;
+  if ( ! getFromCache( P, c ) ) throw OBJECT_DOES_NOT_EXIST;
+  if ( ! c.localChanges || ! c.finalized || c.prepared ) return;
+  string path = cacheDir + "/" + c.cachePath, resized = path + ".resized";
+  struct stat before, after;
+  if ( stat( path.c_str(), &before ) != 0 ) throw OPERATION_FAILED;
+  convert magic;
+  string summary = magic.getComment( path );
+  /* The resized image is written next to the original and renamed over it
+   * only when done, so a concurrent reader sees either the whole original
+   * or the whole resized file (readers holding it open keep the original) */
+  bool haveResized = ( numOfPixels > 0 && magic.resize( numOfPixels, path, resized ) && access( resized.c_str(), F_OK ) == 0 );
+  // The element may have changed while we were working on the file
+  if ( ! getFromCache( P, c ) ) {
+    if ( haveResized ) ::unlink( resized.c_str() );
+    throw OBJECT_DOES_NOT_EXIST;
+  }
+  if ( ! c.finalized || c.write_fd != -1 || stat( path.c_str(), &after ) != 0 ||
+       after.st_mtime != before.st_mtime || after.st_size != before.st_size ) {
+    // Being written to again, it will come back through my_close()
+    if ( haveResized ) ::unlink( resized.c_str() );
+    return;
+  }
+  if ( haveResized && rename( resized.c_str(), path.c_str() ) != 0 ) {
+    LOG( LOG_ERROR, "Could not replace "+path+" by its resized version, uploading it in full size." );
+    ::unlink( resized.c_str() );
+  }
+  c.uploadSummary = summary;
+  c.prepared = true;
+  putIntoCache( P, c );
+}
+
 /*
  * Assumes P is already in the cache, otherwise throws
  */
+// Keeps the backing file of key out of the reach of eviction while it is being downloaded
+struct downloadGuard {
+  boost::mutex &mutex;
+  set<string> &downloading;
+  string key;
+  downloadGuard( boost::mutex &m, set<string> &d, const string &k ): mutex( m ), downloading( d ), key( k ) {
+    boost::mutex::scoped_lock l(mutex);
+    downloading.insert( key );
+  }
+  ~downloadGuard() {
+    boost::mutex::scoped_lock l(mutex);
+    downloading.erase( key );
+  }
+};
+
 void picasaCache::updateImage( const pathParser P ) throw ( enum picasaCache::exceptionType ) {
   cacheElement c;
+  bool downloaded = false;
 
   try {
 
@@ -847,7 +1163,7 @@ void picasaCache::updateImage( const pathParser P ) throw ( enum picasaCache::ex
     throw UNEXPECTED_ERROR;
   }
 
-  if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+  if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
 
   if ( ! photo->PULL_CHANGES() ) {
     LOG( LOG_ERROR, "Could not update photo "+P.getFullName()+". It was probably deleted on picasa." );
@@ -855,11 +1171,13 @@ void picasaCache::updateImage( const pathParser P ) throw ( enum picasaCache::ex
     throw OBJECT_DOES_NOT_EXIST;
   }
 
+  downloadGuard dg( cache_mutex, downloading, P.getHash() );
   if ( c.cachedVersion != photo->getVersion() ) {
     LOG( LOG_NOTICE, "Downloading " + photo->getPhotoURL() + " to " + c.cachePath );
     photo->download(cacheDir+"/"+c.cachePath); // FIXME: make atomic.
     c.cachedVersion = photo->getVersion();
     LOG( LOG_NOTICE, "Downloaded " + photo->getPhotoURL() + "." );
+    downloaded = true;
   }
   c.fromPhoto( photo );
 
@@ -875,20 +1193,26 @@ void picasaCache::updateImage( const pathParser P ) throw ( enum picasaCache::ex
   putIntoCache( P, c );
   } catch( gAPI::exceptionType ex ) {
     if ( ex == gAPI::NO_NETWORK_CONNECTION ) {
-      haveNetworkConnection = false;
       throw NO_NETWORK_CONNECTION;
     } else throw OPERATION_FAILED;
   }
+  // Only now the element says the file is there, so eviction can clear it
+  if ( downloaded ) trackBackingFile( P );
 }
 
 void picasaCache::updateUser ( const pathParser U ) throw ( enum picasaCache::exceptionType ) {
   set<picasaAlbum> albums;
   set<string> albumDirNames;
-  if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+  if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
 
   try {
     albums = picasa->albumList( U.getUser() );
   } catch ( enum picasaService::exceptionType ex ) {
+    if ( ex != picasaService::NOT_FOUND ) {
+      // Keep what we have, the next update will try again
+      LOG(LOG_WARN, "Could not get the complete list of albums of "+U.getUser()+", will try again later." );
+      throw OPERATION_FAILED;
+    }
     LOG(LOG_ERROR, "User "+U.getUser()+" not a valid Picasa account ?" );
     // We remove the user from the cache, if it was present.
     // (we assume it has no local changes, since we
@@ -897,7 +1221,6 @@ void picasaCache::updateUser ( const pathParser U ) throw ( enum picasaCache::ex
     throw OBJECT_DOES_NOT_EXIST;
   } catch( gAPI::exceptionType ex ) {
     if ( ex == gAPI::NO_NETWORK_CONNECTION ) {
-      haveNetworkConnection = false;
       throw NO_NETWORK_CONNECTION;
     } else throw OPERATION_FAILED;
   }
@@ -976,23 +1299,106 @@ void picasaCache::pushChange( const pathParser p ) throw ( enum picasaCache::exc
   struct cacheElement c;
   if ( ! getFromCache( p, c ) ) throw OBJECT_DOES_NOT_EXIST;
   if ( ! c.localChanges ) return;
-  if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+  if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
+  waitForLogin();
   if ( p.getType() == pathParser::IMAGE ) pushImage( p );
   else doUpdate( p );
 }
 
-void picasaCache::doUpdate( const pathParser p ) throw ( enum picasaCache::exceptionType ) {
-  struct cacheElement c;
-  pathParser np;
-  time_t now = time( NULL );
+/*
+ * Updates p from the server. Concurrent updates of the same path (e.g. a file
+ * manager stat-ing a new user directory from several threads) are coalesced.
+ */
+void picasaCache::doUpdate( const pathParser p ) {
   if ( ! p.isValid() ) return;
   if ( ! p.haveUser() ) return;
   if ( isSpecial(p) ) {
     updateSpecial(p);
     return;
   }
+  singleFlight( "update " + p.getHash(), boost::bind( &picasaCache::updateNow, this, p ) );
+}
 
-  if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+void picasaCache::singleFlight( const string &key, boost::function<void ()> work ) {
+  boost::mutex::scoped_lock l(in_flight_mutex);
+  map<string, boost::shared_ptr<struct inFlight> >::iterator it = in_flight.find( key );
+  if ( it != in_flight.end() ) {
+    boost::shared_ptr<struct inFlight> f = it->second;
+    coalesced_count++;
+    // The workers are woken up by interrupts, they must not abort the wait
+    boost::this_thread::disable_interruption di;
+    while( ! f->done ) in_flight_done.wait( l );
+    if ( f->failed ) throw f->error;
+    return;
+  }
+  boost::shared_ptr<struct inFlight> f( new inFlight() );
+  in_flight[key] = f;
+  l.unlock();
+  runFlight( key, f, work );
+}
+
+void picasaCache::runFlight( const string &key, boost::shared_ptr<struct inFlight> f, boost::function<void ()> work ) {
+  boost::mutex::scoped_lock l(in_flight_mutex, boost::defer_lock);
+  try {
+    work();
+  } catch ( enum picasaCache::exceptionType ex ) {
+    f->failed = true;
+    f->error = ex;
+  } catch ( ... ) {
+    // E.g. thread_interrupted, the waiters get UNEXPECTED_ERROR, the owner the original
+    l.lock();
+    f->failed = true;
+    f->done = true;
+    in_flight.erase( key );
+    in_flight_done.notify_all();
+    throw;
+  }
+  l.lock();
+  f->done = true;
+  in_flight.erase( key );
+  in_flight_done.notify_all();
+  if ( f->failed ) throw f->error;
+}
+
+/*
+ * The update is run in the calling thread (together with any other update
+ * of p already under way), each request giving up after the metadata
+ * timeout. With staleWhileRevalidate returns false if it timed out, the
+ * update is then retried in the background.
+ */
+bool picasaCache::foregroundUpdate( const pathParser &p ) {
+  curlRequest::deadlineScope ds( curlRequest::FOREGROUND_METADATA );
+  try {
+    doUpdate( p );
+  } catch ( enum picasaCache::exceptionType ex ) {
+    if ( ! staleWhileRevalidate || ex != NO_NETWORK_CONNECTION || ! haveNetworkConnection ) throw;
+    LOG( LOG_WARN, "Update of "+p.getFullName()+" did not finish in time, answering without it." );
+    {
+      boost::mutex::scoped_lock l(in_flight_mutex);
+      foreground_timeouts++;
+    }
+    pleaseUpdate( p );
+    return false;
+  }
+  return true;
+}
+
+/* With staleWhileRevalidate cached directories are answered as they are
+ * and updated in the background if they are out of date */
+void picasaCache::revalidate( const pathParser &p ) {
+  if ( ! staleWhileRevalidate ) return;
+  if ( p.getType() != pathParser::USER && p.getType() != pathParser::ALBUM ) return;
+  if ( isSpecial( p ) ) return;
+  pleaseUpdate( p );
+}
+
+void picasaCache::updateNow( const pathParser p ) throw ( enum picasaCache::exceptionType ) {
+  struct cacheElement c;
+  pathParser np;
+  waitForLogin();
+  time_t now = time( NULL );
+
+  if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
   /* Object is already present in the cache */
   if ( getFromCache( p, c ) ) {
 
@@ -1031,23 +1437,34 @@ void picasaCache::doUpdate( const pathParser p ) throw ( enum picasaCache::excep
 }
 
 void picasaCache::priority_worker() {
+  // Somebody is usually waiting for the photos in the priority queue
+  curlRequest::deadlineScope ds( curlRequest::FOREGROUND_READ );
   boost::mutex::scoped_lock l(priority_update_queue_mutex);
   l.unlock();
   pathParser p;
   bool wtodo;
   while( ! kill_thread ) {
     l.lock();
-    if ( (! priority_update_queue.empty() ) && haveNetworkConnection ) {
+    if ( (! priority_update_queue.empty() ) && networkAvailable() ) {
       p = priority_update_queue.front();
       l.unlock();
+      bool wait = false;
       try {
 	//log( "update_worker: Processing scheduled job (" + p.getFullName() + ")\n" );
 	doUpdate( p );
-	l.lock();
-	priority_update_queue.pop_front();
-	l.unlock();
       } catch (enum picasaCache::exceptionType ex ) {
 	LOG(LOG_ERROR, "Exception ("+exceptionString( ex ) + ") caught while doing update of "+p.getFullName());
+	// Only a network failure is worth another try, after a while
+	wait = ( ex == NO_NETWORK_CONNECTION );
+      }
+      l.lock();
+      if ( ! wait ) priority_update_queue.pop_front();
+      l.unlock();
+      if ( wait ) {
+	try {
+	  boost::this_thread::sleep( boost::posix_time::seconds( 10 ) );
+	} catch ( ... ) {
+	}
       }
     } else {
       l.unlock();
@@ -1069,6 +1486,7 @@ void picasaCache::update_worker() {
   time_t now;
   bool wtodo;
   while( ! kill_thread ) {
+    tryLogin();
     l.lock();
     if ( ! update_queue.empty() ) {
       p = update_queue.front();
@@ -1084,7 +1502,13 @@ void picasaCache::update_worker() {
     if ( ! local_change_queue.empty() ) {
       p = local_change_queue.front();
       lc.unlock();
-      try {
+      if ( p.getType() == pathParser::IMAGE && networkAvailable() ) {
+	// Photos are resized and uploaded by the pipeline workers
+	lc.lock();
+	local_change_queue.remove(p);
+	lc.unlock();
+	queuePhotoUpload( p );
+      } else try {
 	pushChange( p );
 	lc.lock();
 	local_change_queue.remove(p);
@@ -1101,7 +1525,8 @@ void picasaCache::update_worker() {
     wtodo = ( ! ( update_queue.empty() ) );
     l.unlock();
     lc.lock();
-    wtodo = ( wtodo || ( ! local_change_queue.empty() ) );
+    // Without network the local changes just wait, do not spin on them
+    wtodo = ( wtodo || ( ! local_change_queue.empty() && networkAvailable() ) );
     lc.unlock();
     if ( ! wtodo ) {
       boost::xtime t;
@@ -1117,6 +1542,309 @@ void picasaCache::update_worker() {
   }
 }
 
+/* Accounts the backing files already present from a previous run */
+void picasaCache::initCacheBudget() {
+  {
+    boost::mutex::scoped_lock l(cache_mutex);
+    struct stat st;
+    for( map<string, struct cacheElement>::iterator it = cache.begin(); it != cache.end(); ++it ) {
+      cacheElement &e = it->second;
+      if ( e.type != cacheElement::FILE || e.generated || e.localChanges || e.cachePath == "" ) continue;
+      string fp = cacheDir + "/" + e.cachePath;
+      if ( stat( fp.c_str(), &st ) == 0 ) budget.touch( it->first, st.st_size );
+    }
+  }
+  enforceCacheBudget();
+}
+
+void picasaCache::trackBackingFile( const pathParser &p ) {
+  cacheElement e;
+  struct stat st;
+  if ( ! getFromCache( p, e ) || e.localChanges || e.generated ) return;
+  string fp = cacheDir + "/" + e.cachePath;
+  if ( stat( fp.c_str(), &st ) != 0 ) return;
+  budget.touch( p.getHash(), st.st_size );
+  enforceCacheBudget();
+}
+
+bool picasaCache::no_lock_evictable( const string &key ) {
+  map<string, struct cacheElement>::iterator it = cache.find( key );
+  if ( it == cache.end() ) return true;
+  const cacheElement &e = it->second;
+  if ( e.type != cacheElement::FILE || e.generated ) return false;
+  if ( downloading.find( key ) != downloading.end() ) return false;
+  if ( e.localChanges || e.pinned ) return false;
+  return ( e.numOfOpenWr == 0 && e.read_fd == -1 && e.write_fd == -1 );
+}
+
+/*
+ * Deletes backing files until the budget is met. Evicted photos keep their
+ * metadata, they are downloaded again (by updateImage) when next read.
+ */
+void picasaCache::enforceCacheBudget() {
+  if ( ! budget.overBudget() ) return;
+  boost::mutex::scoped_lock l(cache_mutex); // cache_mutex is always taken before the budget's lock
+  list<string> victims = budget.evict( boost::bind( &picasaCache::no_lock_evictable, this, _1 ) );
+  for( list<string>::iterator key = victims.begin(); key != victims.end(); ++key ) {
+    map<string, struct cacheElement>::iterator it = cache.find( *key );
+    if ( it == cache.end() ) continue;
+    cacheElement &e = it->second;
+    string fp = cacheDir + "/" + e.cachePath;
+    if ( ::unlink( fp.c_str() ) != 0 && errno != ENOENT ) continue;
+    e.cachedVersion = "";
+    e.last_updated = 0;
+    evicted_count++;
+  }
+}
+
+void picasaCache::startPipeline() {
+  for( int i = 0; i < resizeWorkers; i++ )
+    pipeline_threads.create_thread( boost::bind( &picasaCache::prepare_worker, this ) );
+  for( int i = 0; i < uploadWorkers; i++ )
+    pipeline_threads.create_thread( boost::bind( &picasaCache::upload_worker, this ) );
+  pipeline_threads.create_thread( boost::bind( &picasaCache::prefetch_planner, this ) );
+  for( int i = 0; i < prefetchWorkers; i++ )
+    pipeline_threads.create_thread( boost::bind( &picasaCache::prefetch_worker, this ) );
+}
+
+/*
+ * Hands a locally changed photo over to the pipeline. Blocks while the
+ * pipeline is full. A photo which is already being processed is
+ * queued again once the pipeline is done with it.
+ */
+void picasaCache::queuePhotoUpload( const pathParser &p ) {
+  boost::mutex::scoped_lock l(in_pipeline_mutex);
+  if ( in_pipeline.find( p ) != in_pipeline.end() ) {
+    changed_in_pipeline.insert( p );
+    return;
+  }
+  in_pipeline.insert( p );
+  l.unlock();
+  // update_worker is woken up by interrupts, they must not abort the wait
+  boost::this_thread::disable_interruption di;
+  if ( ! prepare_queue.push( p ) ) pipelineDone( p, true );
+}
+
+void picasaCache::pipelineDone( const pathParser &p, bool retry ) {
+  boost::mutex::scoped_lock l(in_pipeline_mutex);
+  in_pipeline.erase( p );
+  if ( changed_in_pipeline.erase( p ) > 0 ) retry = true;
+  l.unlock();
+  if ( retry ) localChange( p );
+}
+
+void picasaCache::prepare_worker() {
+  pathParser p;
+  while( prepare_queue.pop( p ) ) {
+    try {
+      preparePhoto( p );
+      if ( upload_queue.push( p ) ) continue;
+      pipelineDone( p, true );
+    } catch ( enum picasaCache::exceptionType ex ) {
+      LOG(LOG_ERROR, "Exception ("+exceptionString( ex ) + ") caught while preparing "+p.getFullName()+" for upload");
+      pipelineDone( p, ( ex != OBJECT_DOES_NOT_EXIST ) );
+    }
+  }
+}
+
+void picasaCache::upload_worker() {
+  curlRequest::deadlineScope ds( curlRequest::UPLOAD );
+  pathParser p;
+  while( upload_queue.pop( p ) ) {
+    try {
+      pushChange( p );
+      pipelineDone( p, false );
+    } catch ( enum picasaCache::exceptionType ex ) {
+      LOG(LOG_ERROR, "Exception ("+exceptionString( ex ) + ") caught while uploading "+p.getFullName());
+      pipelineDone( p, ( ex == OPERATION_FAILED || ex == NO_NETWORK_CONNECTION ) );
+    }
+  }
+}
+
+void picasaCache::pin( const pathParser &p, bool pinIt ) throw ( enum picasaCache::exceptionType ) {
+  if ( p.getType() != pathParser::ALBUM && p.getType() != pathParser::IMAGE ) throw OPERATION_NOT_SUPPORTED;
+  {
+    boost::mutex::scoped_lock l(cache_mutex);
+    map<string, struct cacheElement>::iterator it = cache.find( p.getHash() );
+    if ( it == cache.end() ) throw OBJECT_DOES_NOT_EXIST;
+    if ( it->second.generated ) throw OPERATION_NOT_SUPPORTED;
+    it->second.pinned = pinIt;
+    for( set<string>::iterator name = it->second.contents.begin(); name != it->second.contents.end(); ++name ) {
+      map<string, struct cacheElement>::iterator ph = cache.find( ( p + *name ).getHash() );
+      if ( ph != cache.end() && ! ph->second.generated ) ph->second.pinned = pinIt;
+    }
+  }
+  LOG( LOG_NOTICE, ( pinIt ? "Pinned " : "Unpinned " ) + p.getFullName() );
+  if ( pinIt ) schedulePrefetch( p );
+  else enforceCacheBudget(); // The unpinned photos may now be over the budget
+}
+
+void picasaCache::schedulePrefetch( const pathParser &p ) {
+  boost::mutex::scoped_lock l(prefetch_mutex);
+  for( list<pathParser>::iterator it = prefetch_requests.begin(); it != prefetch_requests.end(); ++it )
+    if ( *it == p ) return;
+  prefetch_requests.push_back( p );
+  prefetch_wanted.notify_one();
+}
+
+/* Schedules everything pinned (e.g. after a restart or when going online),
+ * photos which are already downloaded are skipped by the planner */
+void picasaCache::resumePrefetch() {
+  list<pathParser> pinned;
+  {
+    boost::mutex::scoped_lock l(cache_mutex);
+    for( map<string, struct cacheElement>::iterator it = cache.begin(); it != cache.end(); ++it ) {
+      if ( ! it->second.pinned ) continue;
+      if ( it->second.type == cacheElement::DIRECTORY || it->second.cachedVersion == "" ) pinned.push_back( pathParser( it->first ) );
+    }
+  }
+  for( list<pathParser>::iterator it = pinned.begin(); it != pinned.end(); ++it ) schedulePrefetch( *it );
+}
+
+/* Returns the pinned photos of p (an album or a photo) which are not downloaded yet */
+list<pathParser> picasaCache::photosToPrefetch( const pathParser &p ) {
+  list<pathParser> ret;
+  cacheElement c;
+  if ( ! getFromCache( p, c ) || ! c.pinned ) return ret;
+  if ( p.getType() == pathParser::ALBUM ) {
+    // Make sure the list of photos is known (does nothing if it is recent)
+    try {
+      doUpdate( p );
+    } catch ( enum picasaCache::exceptionType ex ) {
+      LOG( LOG_WARN, "Could not update pinned album "+p.getFullName()+" ("+exceptionString( ex )+")" );
+    }
+    boost::mutex::scoped_lock l(cache_mutex);
+    map<string, struct cacheElement>::iterator it = cache.find( p.getHash() );
+    if ( it == cache.end() || ! it->second.pinned ) return ret;
+    for( set<string>::iterator name = it->second.contents.begin(); name != it->second.contents.end(); ++name ) {
+      map<string, struct cacheElement>::iterator ph = cache.find( ( p + *name ).getHash() );
+      if ( ph == cache.end() || ph->second.generated || ph->second.localChanges ) continue;
+      ph->second.pinned = true;
+      if ( ph->second.cachedVersion == "" ) ret.push_back( p + *name );
+    }
+  } else if ( c.type == cacheElement::FILE && ! c.localChanges && c.cachedVersion == "" ) {
+    ret.push_back( p );
+  }
+  return ret;
+}
+
+void picasaCache::prefetch_planner() {
+  pathParser p;
+  while( true ) {
+    {
+      boost::mutex::scoped_lock l(prefetch_mutex);
+      while( prefetch_requests.empty() && ! kill_thread ) prefetch_wanted.wait( l );
+      if ( kill_thread ) return;
+      p = prefetch_requests.front();
+      prefetch_requests.pop_front();
+    }
+    if ( ! networkAvailable() ) continue; // resumePrefetch() schedules it again when going online
+    list<pathParser> photos = photosToPrefetch( p );
+    for( list<pathParser>::iterator it = photos.begin(); it != photos.end(); ++it ) {
+      if ( ! prefetch_queue.push( *it ) ) return;
+    }
+  }
+}
+
+void picasaCache::prefetch_worker() {
+  pathParser p;
+  cacheElement c;
+  while( prefetch_queue.pop( p ) ) {
+    // Might have been unpinned or read by someone in the meantime
+    if ( ! getFromCache( p, c ) || ! c.pinned || c.cachedVersion != "" ) continue;
+    try {
+      // Shares the download with a concurrent read of the same photo
+      singleFlight( "update " + p.getHash(), boost::bind( &picasaCache::updateImage, this, p ) );
+      boost::mutex::scoped_lock l(prefetch_mutex);
+      prefetched_count++;
+    } catch ( enum picasaCache::exceptionType ex ) {
+      LOG(LOG_ERROR, "Exception ("+exceptionString( ex ) + ") caught while prefetching "+p.getFullName());
+      boost::mutex::scoped_lock l(prefetch_mutex);
+      prefetch_failed_count++;
+    }
+  }
+}
+
+void picasaCache::updatePinnedFile() {
+  stringstream os;
+  {
+    boost::mutex::scoped_lock l(cache_mutex);
+    for( map<string, struct cacheElement>::iterator it = cache.begin(); it != cache.end(); ++it ) {
+      if ( ! it->second.pinned ) continue;
+      pathParser p( it->first );
+      if ( it->second.type == cacheElement::DIRECTORY ) {
+	int total = 0, local = 0;
+	for( set<string>::iterator name = it->second.contents.begin(); name != it->second.contents.end(); ++name ) {
+	  map<string, struct cacheElement>::iterator ph = cache.find( ( p + *name ).getHash() );
+	  if ( ph == cache.end() || ph->second.generated ) continue;
+	  total++;
+	  if ( ph->second.cachedVersion != "" || ph->second.localChanges ) local++;
+	}
+	os << p.getFullName() << ": " << local << "/" << total << " photos downloaded" << endl;
+      } else {
+	map<string, struct cacheElement>::iterator album = cache.find( p.chop().getHash() );
+	if ( album != cache.end() && album->second.pinned ) continue; // Listed with the album
+	os << p.getFullName() << ": " << ( it->second.cachedVersion != "" ? "downloaded" : "not downloaded yet" ) << endl;
+      }
+    }
+  }
+  {
+    boost::mutex::scoped_lock l(prefetch_mutex);
+    os << "Prefetch: " << prefetch_requests.size() << " albums waiting, " << prefetch_queue.size() << " photos queued, "
+       << prefetched_count << " downloaded, " << prefetch_failed_count << " failed (" << prefetchWorkers << " workers)" << endl;
+  }
+  struct cacheElement e;
+  if ( ! getFromCache( pinnedPath, e ) ) return;
+  e.cachePath = os.str();
+  e.size = e.cachePath.size();
+  putIntoCache( pinnedPath, e );
+}
+
+/* Called when the photo P is opened for reading, local is true if it was
+ * already downloaded */
+void picasaCache::readAhead( const pathParser &P, bool local ) {
+  cacheElement a, n;
+  if ( ! getFromCache( P.chop(), a ) ) return;
+  set<string>::iterator cur = a.contents.find( P.getImage() );
+  if ( cur == a.contents.end() ) return;
+
+  list<pathParser> candidates;
+  boost::mutex::scoped_lock l(readahead_mutex);
+  if ( readahead_issued.erase( P.getHash() ) > 0 ) {
+    if ( local ) readahead_hits++;
+    else readahead_late++;
+  }
+  struct readAheadState &s = readahead[P.chop().getHash()];
+  if ( s.last == P.getImage() ) return; // Opened again, not a new access
+  // Skipping a photo (e.g. a video the viewer does not show) still counts as sequential
+  bool sequential = false;
+  set<string>::iterator prev = cur;
+  for( int i = 0; i < 2 && prev != a.contents.begin() && ! sequential; i++ ) {
+    --prev;
+    sequential = ( *prev == s.last );
+  }
+  if ( sequential ) s.window = ( s.window == 0 ) ? 2 : min( 2*s.window, maxReadAhead );
+  else s.window /= 2;
+  s.last = P.getImage();
+  set<string>::iterator next = cur;
+  for( int i = 0; i < s.window && ++next != a.contents.end(); i++ ) {
+    pathParser N = P.chop() + *next;
+    if ( readahead_issued.find( N.getHash() ) == readahead_issued.end() ) candidates.push_back( N );
+  }
+  l.unlock();
+
+  for( list<pathParser>::iterator it = candidates.begin(); it != candidates.end(); ++it ) {
+    if ( ! getFromCache( *it, n ) || n.type != cacheElement::FILE || n.generated || n.localChanges ) continue;
+    if ( n.cachedVersion != "" ) continue; // Already downloaded
+    l.lock();
+    if ( readahead_issued.size() > 1024 ) readahead_issued.clear(); // Photos queued but never opened
+    readahead_issued.insert( it->getHash() );
+    readahead_count++;
+    l.unlock();
+    pleaseUpdate( *it, true );
+  }
+}
+
 void picasaCache::sync() {
   list<pathParser> failed_list;
   boost::mutex::scoped_lock lc(local_change_queue_mutex);
@@ -1161,6 +1889,7 @@ bool picasaCache::getFromCache( const pathParser &p, struct cacheElement &e ) {
 
 void picasaCache::putIntoCache( const pathParser &p, const struct cacheElement &e ) {
   if ( ! isSpecial( p ) ) cacheMkdir( cacheDir, p );
+  if ( e.type == cacheElement::DIRECTORY ) forgetMissing( p );
   boost::mutex::scoped_lock l(cache_mutex);
   cache[p.getHash()] = e;
 }
@@ -1195,6 +1924,7 @@ void picasaCache::no_lock_removeFromCache( const pathParser &p ) {
       } catch (...) {}
       break;
   }
+  budget.remove( key );
   update_queue.remove( p );
   cache.erase( key );
 }
@@ -1236,6 +1966,7 @@ string picasaCache::getXAttr( const pathParser &p, const string &attrName ) thro
     return ss.str();
   }
   if ( isSpecial( p ) ) throw OBJECT_DOES_NOT_EXIST;
+  if ( attrName == "Pinned" ) return ( c.pinned ? "1" : "0" );
   c.buildPicasaObj( picasa );
   if ( ! c.picasaObj ) throw UNEXPECTED_ERROR;
   if ( attrName == "AuthKey" && p.getType() == pathParser::ALBUM ) {
@@ -1245,7 +1976,13 @@ string picasaCache::getXAttr( const pathParser &p, const string &attrName ) thro
   try {
     ret = c.picasaObj->getAttr( attrName );
   } catch ( atomObj::exceptionType ) {
-    throw OBJECT_DOES_NOT_EXIST;
+    // The listing might have left it out
+    if ( ! c.partial || ! completeEntry( p, c ) ) throw OBJECT_DOES_NOT_EXIST;
+    try {
+      ret = c.picasaObj->getAttr( attrName );
+    } catch ( atomObj::exceptionType ) {
+      throw OBJECT_DOES_NOT_EXIST;
+    }
   }
   return ret;
 }
@@ -1256,11 +1993,13 @@ list<string> picasaCache::listXAttr( const pathParser &p ) throw (enum exception
   list<string> ret;
   ret.push_back( "CacheElement" );
   if ( isSpecial( p ) ) return ret;
+  completeEntry( p, c ); // if it fails, the elements from the listing have to do
   c.buildPicasaObj( picasa );
   if ( ! c.picasaObj ) throw UNEXPECTED_ERROR;
   try {
     ret = c.picasaObj->listAttr();
     ret.push_back( "AuthKey" );
+    ret.push_back( "Pinned" );
   } catch ( atomObj::exceptionType ) {
     throw OBJECT_DOES_NOT_EXIST;
   }
@@ -1274,31 +2013,34 @@ int picasaCache::getAttr( const pathParser &path, struct stat *stBuf ) {
     // and the path is not cached it doesn't exist
     // (at least not now, maybe at some later point,
     // when we update the parent directory)
-    switch ( path.getType() ) {
-      case pathParser::USER:
-	try {
-	  doUpdate( path );
-	} catch ( enum exceptionType ex ) {
-	  return -ENOENT;
-	}
-	if ( ! getFromCache( path, e ) ) return -ENOENT;
-	break;
-      case pathParser::ALBUM:
-	if ( ! (path.getAlbum() == ".directory") ) { // the .directory files are often looked up by kde applications
-	  try {
-	    doUpdate( path );
-	  } catch ( enum exceptionType ex ) {
-	    return -ENOENT;
-	  }
-	  break;
-	}
-	return -ENOENT;
-	break;
-      default:
+    if ( path.getType() != pathParser::USER && path.getType() != pathParser::ALBUM ) return -ENOENT;
+    if ( path.getType() == pathParser::ALBUM && path.getAlbum() == ".directory" ) return -ENOENT; // the .directory files are often looked up by kde applications
+    // Desktops probe for .hidden, desktop.ini, .Trash-1000, ... over and over
+    if ( knownMissing( path ) ) return -ENOENT;
+    try {
+      if ( ! foregroundUpdate( path ) ) return -EAGAIN;
+    } catch ( enum exceptionType ex ) {
+      // Only a definite answer from the server is worth remembering
+      if ( ex == OBJECT_DOES_NOT_EXIST ) rememberMissing( path );
+      else if ( ex == NO_NETWORK_CONNECTION && haveNetworkConnection ) {
+	// Timed out (or the server is unreachable), let the background update try harder
+	pleaseUpdate( path );
+	return -EAGAIN;
+      }
+      return -ENOENT;
+    }
+    if ( ! getFromCache( path, e ) ) {
+      if ( path.getType() == pathParser::USER || path.getAlbum().find( "?authkey=" ) == string::npos ) {
+	rememberMissing( path );
 	return -ENOENT;
+      }
+      // An unlisted album, it was added under its real name
+      e.type = cacheElement::DIRECTORY;
     }
-  }
+  } else if ( e.type == cacheElement::DIRECTORY ) revalidate( path );
   stBuf->st_size = e.size;
+  stBuf->st_mtime = stBuf->st_atime = e.mtime;
+  stBuf->st_ctime = e.ctime;
   switch ( e.type ) {
 	  case cacheElement::DIRECTORY:
 		  stBuf->st_mode = S_IFDIR | S_IRUSR | S_IXUSR;
@@ -1316,6 +2058,11 @@ int picasaCache::getAttr( const pathParser &path, struct stat *stBuf ) {
 		    struct stat myStat;
 		    if ( stat( fp.c_str(), &myStat ) == 0 ) {
 		      stBuf->st_size = myStat.st_size;
+		      // Not yet on the server, the local file is the truth
+		      if ( e.localChanges || e.mtime == 0 ) {
+			stBuf->st_mtime = stBuf->st_atime = myStat.st_mtime;
+			stBuf->st_ctime = myStat.st_ctime;
+		      }
 		    }
 		  }
 		  return 0;
@@ -1323,6 +2070,60 @@ int picasaCache::getAttr( const pathParser &path, struct stat *stBuf ) {
   return 0;
 }
 
+bool picasaCache::knownMissing( const pathParser &p ) {
+  boost::mutex::scoped_lock l(negative_mutex);
+  map<string, map<string, time_t> >::iterator dir = negative_lookups.find( p.chop().getHash() );
+  if ( dir == negative_lookups.end() ) return false;
+  map<string, time_t>::iterator it = dir->second.find( p.getLastComponent() );
+  if ( it == dir->second.end() ) return false;
+  if ( it->second < time( NULL ) ) {
+    dir->second.erase( it );
+    negative_count--;
+    return false;
+  }
+  negative_hits++;
+  return true;
+}
+
+void picasaCache::rememberMissing( const pathParser &p ) {
+  boost::mutex::scoped_lock l(negative_mutex);
+  if ( negative_count >= maxNegativeEntries ) {
+    // Entries expire quickly anyway, no need to be clever about which to drop
+    negative_lookups.clear();
+    negative_count = 0;
+  }
+  map<string, time_t> &dir = negative_lookups[p.chop().getHash()];
+  if ( dir.find( p.getLastComponent() ) == dir.end() ) negative_count++;
+  dir[p.getLastComponent()] = time( NULL ) + negativeTTL;
+}
+
+/* dir was (re)read or created, so its own entry and the entries of its children are stale */
+void picasaCache::forgetMissing( const pathParser &dir ) {
+  boost::mutex::scoped_lock l(negative_mutex);
+  if ( negative_count == 0 ) return;
+  map<string, map<string, time_t> >::iterator it = negative_lookups.find( dir.getHash() );
+  if ( it != negative_lookups.end() ) {
+    negative_count -= it->second.size();
+    negative_lookups.erase( it );
+  }
+  it = negative_lookups.find( dir.chop().getHash() );
+  if ( it != negative_lookups.end() ) negative_count -= it->second.erase( dir.getLastComponent() );
+}
+
+/* With a cache budget df shows the budget and how much of it is used,
+ * otherwise the file system holding the cache directory */
+int picasaCache::statFS( struct statvfs *stBuf ) {
+  if ( statvfs( cacheDir.c_str(), stBuf ) != 0 ) return -errno;
+  unsigned long long limit = budget.getBudget(), used = budget.getUsage();
+  unsigned long blockSize = stBuf->f_frsize ? stBuf->f_frsize : stBuf->f_bsize;
+  if ( limit == 0 || blockSize == 0 ) return 0;
+  fsblkcnt_t freeBlocks = ( used < limit ) ? ( limit - used ) / blockSize : 0;
+  stBuf->f_blocks = limit / blockSize;
+  if ( freeBlocks < stBuf->f_bfree ) stBuf->f_bfree = freeBlocks;
+  if ( freeBlocks < stBuf->f_bavail ) stBuf->f_bavail = freeBlocks;
+  return 0;
+}
+
 void picasaCache::needPath( const pathParser &path ) {
   pleaseUpdate( path );
 }
@@ -1353,12 +2154,12 @@ void picasaCache::unlink( const pathParser &p ) throw ( enum picasaCache::except
   if ( ! photo ) {
     if ( ! c.localChanges ) throw OPERATION_FAILED;
   } else {
-    if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+    if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
+    waitForLogin();
     try {
       photo->DELETE();
     } catch( gAPI::exceptionType ex ) {
       if ( ex == gAPI::NO_NETWORK_CONNECTION ) {
-	haveNetworkConnection = false;
 	throw NO_NETWORK_CONNECTION;
       } else throw OPERATION_FAILED;
     } catch (...) {
@@ -1388,12 +2189,12 @@ void picasaCache::rmdir( const pathParser &p ) throw ( enum picasaCache::excepti
     if ( ! album ) {
       if ( ! c.localChanges ) throw OPERATION_FAILED;
     } else {
-      if ( ! haveNetworkConnection ) throw NO_NETWORK_CONNECTION;
+      if ( ! networkAvailable() ) throw NO_NETWORK_CONNECTION;
+      waitForLogin();
       try {
 	album->DELETE();
       } catch( gAPI::exceptionType ex ) {
 	if ( ex == gAPI::NO_NETWORK_CONNECTION ) {
-	  haveNetworkConnection = false;
 	  throw NO_NETWORK_CONNECTION;
 	} else throw OPERATION_FAILED;
       } catch (...) {
@@ -1428,6 +2229,7 @@ void picasaCache::create( const pathParser &p ) throw ( enum picasaCache::except
   c.type=cacheElement::FILE;
   c.localChanges=true;
   c.finalized=false;
+  c.prepared=false;
   c.generated = false;
   c.authKey="";
   c.name=p.getImage();
@@ -1462,9 +2264,14 @@ void picasaCache::my_open( const pathParser &p, int flags ) throw ( enum picasaC
       if ( c.read_fd == -1 ) {
 	string absPath = cacheDir + "/" + c.cachePath;
 	c.read_fd = open( absPath.c_str() , O_RDONLY );
-	if ( c.read_fd > -1 ) num_of_open_fds++;
+	if ( c.read_fd > -1 ) {
+	  num_of_open_fds++;
+	  struct stat st;
+	  if ( ! c.localChanges && fstat( c.read_fd, &st ) == 0 ) budget.touch( p.getHash(), st.st_size );
+	}
       }
       putIntoCache( p, c);
+      if ( p.getType() == pathParser::IMAGE && ! c.localChanges ) readAhead( p, c.read_fd != -1 );
       return;
     }
   }
@@ -1508,7 +2315,7 @@ set<string> picasaCache::ls( const pathParser &path ) throw ( enum picasaCache::
     return e.contents;
   } else {
     if ( ! isDir(path) ) throw OPERATION_NOT_SUPPORTED;
-    doUpdate( path );
+    if ( ! foregroundUpdate( path ) ) throw NO_NETWORK_CONNECTION;
     if ( getFromCache( path, e ) ) {
       if ( e.type != cacheElement::DIRECTORY ) throw OPERATION_NOT_SUPPORTED;
       return e.contents;
@@ -1543,6 +2350,8 @@ int picasaCache::read( const pathParser &path, char *buf, size_t size, off_t off
       if ( e.read_fd != -1 ) {
 	putIntoCache( path, e );
 	num_of_open_fds++;
+	struct stat st;
+	if ( ! e.localChanges && fstat( e.read_fd, &st ) == 0 ) budget.touch( path.getHash(), st.st_size );
       } else {
         char *errBuf = strerror( errno );
         string err = "Error opening "+absPath+" (";
@@ -1572,6 +2381,7 @@ int picasaCache::my_write( const pathParser &path, const char *buf, size_t size,
     }
     e.localChanges = true;
     e.finalized = false;
+    e.prepared = false;
     putIntoCache( path, e );
     return pwrite( e.write_fd, buf, size, offset );
   } else return -ENOENT;
@@ -1595,10 +2405,7 @@ void picasaCache::my_close( const pathParser &path ) {
 	num_of_open_fds--;
       }
       if ( e.localChanges ) {
-	if ( numOfPixels > 0 ) {
-	  convert magic;
-	  magic.resize( numOfPixels, cacheDir + "/" + e.cachePath );
-        }
+	// Resizing is left to the upload pipeline, so that release() returns at once
         e.finalized = true;
         e.last_updated=0;
 	putIntoCache( path, e );
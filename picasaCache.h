@@ -26,12 +26,16 @@
 
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/serialization/version.hpp>
 
 class gAPI;
 class picasaService;
 struct fuse_file_info;
 struct stat;
+struct statvfs;
 class pathParser;
 class atomEntry;
 class picasaAlbum;
@@ -42,6 +46,8 @@ class picasaPhoto;
 #include "picasaAlbum.h"
 #include "picasaPhoto.h"
 #include "config.h"
+#include "boundedQueue.h"
+#include "cacheBudget.h"
 
 
 struct cacheElement { 
@@ -56,29 +62,37 @@ struct cacheElement {
   ssize_t size;
   bool world_readable, writeable;
   bool localChanges; // true if local changes not yet pushed to the server
+  bool pinned; // never evicted from the backing store
   bool finalized; // false for files which were changed and not yet closed, true for everything else (also not cached to disk)
   int numOfOpenWr; // Number of times the element was opend (not only for writing !!!)
 
   std::time_t last_updated;
+  std::time_t mtime, ctime; // as reported by getattr, taken from the entry when it is parsed
   
   std::string xmlRepresentation; // To reconstruct either picasaPhoto or picasaAlbum from...
+  bool partial; // xmlRepresentation comes from a listing which asked only for some of the elements
   atomEntryPtr picasaObj; // Constructed from the xmlRepresentation
   std::string cachedVersion; // The "checksum" of the object (ETag)
    
   /* only for DIRECTORY */
   std::string authKey;
   std::set<std::string> contents;
+  std::time_t synced; // when the photo list was last completely synchronized (0 if never)
+  long remotePhotos; // how many of the contents are photos on the server (as of synced)
 
   /* only for FILE */
   bool generated;
   std::string cachePath;
   int read_fd,write_fd;
+  bool prepared; // resized and caption extracted (into uploadSummary), so a retried upload can skip that
+  std::string uploadSummary;
  
 
   cacheElement(): name(""), size(0), world_readable(false), writeable(false),
-		  localChanges(false), last_updated(0), xmlRepresentation(""),
-		  cachedVersion(""), authKey(""), generated(false),
-		  cachePath(""), numOfOpenWr(0), read_fd(-1),write_fd(-1) {};
+		  localChanges(false), pinned(false), last_updated(0), mtime(0), ctime(0), xmlRepresentation(""), partial(false),
+		  cachedVersion(""), authKey(""), synced(0), remotePhotos(0), generated(false),
+		  cachePath(""), numOfOpenWr(0), read_fd(-1),write_fd(-1),
+		  prepared(false), uploadSummary("") {};
 		  
   const struct cacheElement &operator=(const struct cacheElement &e);
   
@@ -94,15 +108,29 @@ struct cacheElement {
 	      ar & cachedVersion;
 	      ar & last_updated;
 	      ar & localChanges;
+	      if ( version >= 2 ) {
+		ar & mtime;
+		ar & ctime;
+	      }
+	      if ( version >= 3 ) ar & pinned;
+	      if ( version >= 4 ) ar & partial;
 
 	      switch ( type ) { 
 		      case cacheElement::DIRECTORY:
 			      ar & authKey;
 			      ar & contents;
+			      if ( version >= 5 ) {
+				ar & synced;
+				ar & remotePhotos;
+			      }
 			      break;
 		      case cacheElement::FILE:
 			      ar & generated;
 			      ar & cachePath;
+			      if ( version >= 1 ) {
+				ar & prepared;
+				ar & uploadSummary;
+			      }
 			      break;
 	      }
 	    }
@@ -115,10 +143,14 @@ struct cacheElement {
    * Takes ownership of photo
    */
   void fromPhoto( picasaPhotoPtr photo );
+
+  void timesFromEntry( const atomEntry &entry );
   
   friend std::ostream &operator<<( std::ostream &out, const cacheElement &element );
 };
 
+BOOST_CLASS_VERSION( cacheElement, 5 )
+
 
 class picasaCache { 
 	public:
@@ -136,7 +168,7 @@ class picasaCache {
 
 		void needPath( const pathParser &p );
 
-		bool isOffline() const { return ( ! haveNetworkConnection ); };
+		bool isOffline() const { return ( ! networkAvailable() ); };
 		bool goOffLine(); 
 		bool goOnline();
 
@@ -144,7 +176,10 @@ class picasaCache {
                 int read( const pathParser &p, char *buf, size_t size, off_t offset, struct fuse_file_info *fi );
 		std::string getXAttr( const pathParser &p, const std::string &attrName ) throw (enum exceptionType);
 		std::list<std::string> listXAttr( const pathParser &p ) throw (enum exceptionType);
+		/* Pinned albums/photos are downloaded completely and never evicted */
+		void pin( const pathParser &p, bool pinIt ) throw (enum exceptionType);
 		int getAttr( const pathParser &p, struct stat *stBuf );
+		int statFS( struct statvfs *stBuf );
 		
 		void unlink( const pathParser &p ) throw ( enum exceptionType );
 		void rmdir( const pathParser &p ) throw (enum exceptionType);
@@ -164,21 +199,60 @@ class picasaCache {
 		long maxJobThreads;
 		
 		int updateInterval;
-		volatile bool haveNetworkConnection;
+		volatile bool haveNetworkConnection; // false if the user asked us to work offline
+		bool networkAvailable() const;
+		time_t last_login_attempt;
+		void tryLogin();
+		boost::shared_ptr<boost::thread> connect_thread;
+		boost::mutex login_mutex;
+		boost::condition_variable login_done;
+		bool login_pending; // goOnline() started connect_thread, which did not finish yet
+		void connect_worker();
+		void waitForLogin();
 		boost::shared_ptr<boost::thread> update_thread, priority_update_thread;
 		boost::mutex priority_update_queue_mutex, update_queue_mutex, local_change_queue_mutex, job_threads_mutex;
 		std::list<pathParser> update_queue,local_change_queue, priority_update_queue;
 		volatile bool work_to_do;
 		volatile bool kill_thread;
 		void update_worker();
-		void doUpdate( const pathParser p ) throw ( enum picasaCache::exceptionType );
+		void doUpdate( const pathParser p );
+		void updateNow( const pathParser p ) throw ( enum picasaCache::exceptionType );
+
+		/* Updates done on behalf of a FUSE call, their requests give up
+		 * after the metadata timeout */
+		bool staleWhileRevalidate;
+		int foreground_timeouts;
+		bool foregroundUpdate( const pathParser &p );
+		void revalidate( const pathParser &p );
+
+		/* Single flight: concurrent calls with the same key run work only
+		 * once, the other callers wait for it and get its result. Other
+		 * exceptions than exceptionType reach only the caller running work. */
+		struct inFlight {
+			bool done, failed;
+			enum exceptionType error;
+			inFlight(): done(false), failed(false), error(UNEXPECTED_ERROR) {};
+		};
+		boost::mutex in_flight_mutex;
+		boost::condition_variable in_flight_done;
+		std::map<std::string, boost::shared_ptr<struct inFlight> > in_flight;
+		int coalesced_count;
+		void singleFlight( const std::string &key, boost::function<void ()> work );
+		void runFlight( const std::string &key, boost::shared_ptr<struct inFlight> f, boost::function<void ()> work );
 		void priority_worker();
 		void pushChange( const pathParser p ) throw ( enum picasaCache::exceptionType );
 
 		void updateUser( const pathParser p ) throw ( enum picasaCache::exceptionType );
 		void updateAlbum( const pathParser p ) throw ( enum picasaCache::exceptionType );
+		/* A delta listing of an album asks for the photos updated since the last
+		 * sync minus this many seconds, to allow for our clock being ahead */
+		static const int syncMargin = 600;
+		void albumPhoto( const pathParser &A, cacheElement &album, std::set<std::string> &seen, bool &newPinned, picasaPhotoPtr photo );
+		long remotePhotoCount( const pathParser &A, const cacheElement &album );
+		bool completeEntry( const pathParser &p, cacheElement &c );
 		void updateImage( const pathParser p ) throw ( enum picasaCache::exceptionType );
 		void updateStatsFile();
+		void updateHttpStatsFile();
 		void updateAuthKeys();
 		void updateLCQueueFile();
                 void updateUQueueFile();
@@ -189,6 +263,77 @@ class picasaCache {
 		void localChange( const pathParser p );
 
 		void pushImage( const pathParser p ) throw ( enum picasaCache::exceptionType );
+		void preparePhoto( const pathParser p ) throw ( enum picasaCache::exceptionType );
+
+		/* Photo upload pipeline: resizeWorkers threads prepare photos (resize,
+		 * caption extraction) and hand them over to uploadWorkers threads.
+		 * The bounded queues between the stages limit the work in flight. */
+		int resizeWorkers, uploadWorkers;
+		boundedQueue<pathParser> prepare_queue, upload_queue;
+		boost::thread_group pipeline_threads;
+		boost::mutex in_pipeline_mutex;
+		std::set<pathParser> in_pipeline, changed_in_pipeline;
+		void startPipeline();
+		void queuePhotoUpload( const pathParser &p );
+		void pipelineDone( const pathParser &p, bool retry );
+		void prepare_worker();
+		void upload_worker();
+
+		/* Downloaded photos are accounted in budget, when it is exceeded
+		 * the backing files chosen by it are deleted (the metadata stays) */
+		cacheBudget budget;
+		int evicted_count;
+		std::set<std::string> downloading; // photos being downloaded, guarded by cache_mutex
+		void initCacheBudget();
+		void enforceCacheBudget();
+		void trackBackingFile( const pathParser &p );
+		// WARNING: Need to acquire a lock on cache_mutex before calling this function.
+		bool no_lock_evictable( const std::string &key );
+
+		/* Prefetching of pinned albums: the planner thread lists the photos
+		 * of the albums in prefetch_requests which are not downloaded yet,
+		 * prefetchWorkers threads download them. */
+		int prefetchWorkers;
+		boost::mutex prefetch_mutex;
+		boost::condition_variable prefetch_wanted;
+		std::list<pathParser> prefetch_requests;
+		boundedQueue<pathParser> prefetch_queue;
+		int prefetched_count, prefetch_failed_count;
+		void schedulePrefetch( const pathParser &p );
+		void resumePrefetch();
+		std::list<pathParser> photosToPrefetch( const pathParser &p );
+		void prefetch_planner();
+		void prefetch_worker();
+		void updatePinnedFile();
+
+		/* Read-ahead: when the photos of an album are opened in order
+		 * (of contents), the next window photos are put into the priority
+		 * queue. The window doubles while the access stays sequential and
+		 * is halved by every random access. */
+		struct readAheadState {
+			std::string last; // the last photo opened in the album
+			int window;
+			readAheadState(): window(0) {};
+		};
+		static const int maxReadAhead = 16;
+		boost::mutex readahead_mutex;
+		std::map<std::string, struct readAheadState> readahead; // indexed by album hash
+		std::set<std::string> readahead_issued; // photos queued by read-ahead and not opened yet
+		int readahead_count, readahead_hits, readahead_late;
+		void readAhead( const pathParser &p, bool local );
+
+		/* Users/albums which recently failed to be looked up on the server,
+		 * getAttr answers ENOENT for them without network access until
+		 * they expire or their parent directory is refreshed */
+		static const int negativeTTL = 300;
+		static const size_t maxNegativeEntries = 4096;
+		boost::mutex negative_mutex;
+		std::map<std::string, std::map<std::string, time_t> > negative_lookups; // parent hash -> name -> expiry
+		size_t negative_count;
+		int negative_hits;
+		bool knownMissing( const pathParser &p );
+		void rememberMissing( const pathParser &p );
+		void forgetMissing( const pathParser &dir );
 		void pushAlbum( const pathParser p ) throw ( enum picasaCache::exceptionType );
 		void newAlbum( const pathParser p ) throw ( enum picasaCache::exceptionType );
 
@@ -202,7 +347,7 @@ class picasaCache {
 	
 		void createRootDir();
 		void insertControlDir();
-		static const pathParser controlDirPath, logPath, statsPath, updateQueuePath, priorityQueuePath, localChangesQueuePath, authKeysPath, syncPath, offlinePath, onlinePath, helpPath;
+		static const pathParser controlDirPath, pinnedPath, logPath, statsPath, httpStatsPath, updateQueuePath, priorityQueuePath, localChangesQueuePath, authKeysPath, syncPath, offlinePath, onlinePath, helpPath;
 		bool isSpecial( const pathParser &path );
 
 		enum logLevel { LOG_DEBUG, LOG_NOTICE, LOG_WARN, LOG_ERROR, LOG_CRIT };
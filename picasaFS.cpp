@@ -9,6 +9,7 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <sys/statvfs.h>
 #include <linux/xattr.h>
 
 #include <iostream>
@@ -61,6 +62,11 @@ int PicasaFS::fgetattr( const char *path, struct stat *stbuf, struct fuse_file_i
   return PicasaFS::getattr( path, stbuf );
 }
 
+int PicasaFS::statfs( const char *, struct statvfs *stbuf ) {
+  memset( stbuf, 0, sizeof (struct statvfs) );
+  return self->cache->statFS( stbuf );
+}
+
 int PicasaFS::getxattr( const char *path, const char *attrName, char *buf, size_t sz ) {
   pathParser p( path );
   string attr( attrName );
@@ -78,6 +84,31 @@ int PicasaFS::getxattr( const char *path, const char *attrName, char *buf, size_
   return value.size();
 }
 
+/* Only user.Pinned can be set (any value but 0 pins) */
+int PicasaFS::setxattr( const char *path, const char *attrName, const char *value, size_t sz, int ) {
+  pathParser p( path );
+  if ( string( attrName ) != "user.Pinned" ) return -ENOTSUP;
+  try {
+    self->cache->pin( p, string( value, sz ) != "0" );
+  } catch ( enum picasaCache::exceptionType ex ) {
+    if ( ex == picasaCache::OBJECT_DOES_NOT_EXIST ) return -ENOENT;
+    return -ENOTSUP;
+  }
+  return 0;
+}
+
+int PicasaFS::removexattr( const char *path, const char *attrName ) {
+  pathParser p( path );
+  if ( string( attrName ) != "user.Pinned" ) return -ENOTSUP;
+  try {
+    self->cache->pin( p, false );
+  } catch ( enum picasaCache::exceptionType ex ) {
+    if ( ex == picasaCache::OBJECT_DOES_NOT_EXIST ) return -ENOENT;
+    return -ENOTSUP;
+  }
+  return 0;
+}
+
 int PicasaFS::listxattr( const char *path, char *buf, size_t sz ) {
   list<string> attrList;
   int ret = 0;
@@ -18,8 +18,11 @@ class PicasaFS : public fusexx::fuse<PicasaFS> {
                   // Overload the fuse methods
 		  static int getattr (const char *, struct stat *);
 		  static int fgetattr (const char *, struct stat *, struct fuse_file_info *);
+		  static int statfs (const char *, struct statvfs *);
 		  static int getxattr (const char *, const char *, char *, size_t );
 		  static int listxattr ( const char *, char *, size_t );
+		  static int setxattr ( const char *, const char *, const char *, size_t, int );
+		  static int removexattr ( const char *, const char * );
 		  static int readdir (const char *, void *, fuse_fill_dir_t, off_t, struct fuse_file_info *);
 		  static int fuse_open (const char *, struct fuse_file_info *);
 		  static int release( const char *, struct fuse_file_info *);
@@ -27,6 +27,15 @@ static struct fuse_opt myfs_opts[] = {
   MYFS_OPT("passsword=%s",		password, 0),
   MYFS_OPT("resize=%i",			maxPixels, 0),
   MYFS_OPT("--offline",			offline, 1 ),
+  MYFS_OPT("--hedge",			hedge, 1 ),
+  MYFS_OPT("resize-workers=%i",		resizeWorkers, 0),
+  MYFS_OPT("upload-workers=%i",		uploadWorkers, 0),
+  MYFS_OPT("cache-size=%i",		cacheSize, 0),
+  MYFS_OPT("--stale-ok",		staleOK, 1 ),
+  MYFS_OPT("metadata-timeout=%i",	metadataTimeout, 0),
+  MYFS_OPT("read-timeout=%i",		readTimeout, 0),
+  MYFS_OPT("refresh-timeout=%i",	refreshTimeout, 0),
+  MYFS_OPT("upload-timeout=%i",		uploadTimeout, 0),
 #ifdef HAVE_DBUS
   MYFS_OPT("--use-keyring=false",       useKeyRing, 0 ),
 #endif
@@ -60,6 +69,20 @@ static int myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
 	       "    -o password=STRING		the password for username (CAUTION PASSING PASSWORD ON THE COMMANDLINE IS INSECURE)\n"
 	       "    -o resize=NUM		resize to at most NUM pixels when uploading pictures\n"
 	       "    --offline			do not try any network operations, work locally\n"
+	       "    -o resize-workers=NUM	number of photos resized in parallel before upload (default 2)\n"
+	       "    -o upload-workers=NUM	number of photos uploaded in parallel (default 3)\n"
+	       "    -o cache-size=NUM		keep at most NUM Mb of downloaded photos, evicting the least useful\n"
+	       "				(photos with local changes and pinned photos are never evicted)\n"
+	       "    --hedge			duplicate slow downloads on a second connection\n"
+	       "    --stale-ok			answer from the cache at once, even if it is out of date, and\n"
+	       "				update it in the background (things which are not cached at\n"
+	       "				all are waited for at most metadata-timeout seconds)\n"
+	       "    -o metadata-timeout=NUM	give up on a lookup/listing done for an application after\n"
+	       "				NUM seconds (default 15)\n"
+	       "    -o read-timeout=NUM		the same for downloads of photos being read (default 60)\n"
+	       "    -o refresh-timeout=NUM	the same for background updates (default 180)\n"
+	       "    -o upload-timeout=NUM	the same for uploads (default: no limit)\n"
+	       "				(stalled connections are always given up on after 30s)\n"
 #ifdef HAVE_DBUS
 	       "    --use-keyring=false		do not try to use the kde wallet\n"
 #endif
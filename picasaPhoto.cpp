@@ -11,6 +11,9 @@
  *CHANGES:
  ***************************************************************/
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #include <boost/filesystem/operations.hpp>
 
 #include "picasaPhoto.h"
@@ -29,22 +32,44 @@ using namespace std;
 
 
 picasaPhoto::picasaPhoto(gAPI* api, const string& xml): atomEntry(api) {
-  if ( xml != "" ) loadFromXML(xml);
+  if ( xml != "" && loadFromXML(xml) ) extractMediaEditURL();
 }
 
-picasaPhoto::picasaPhoto(const picasaPhoto& p): atomEntry(p) {
+picasaPhoto::picasaPhoto(const picasaPhoto& p): atomEntry(p), mediaEditURL( p.mediaEditURL ), resumableEditURL( p.resumableEditURL ) {
 
 }
 
 
-void picasaPhoto::extractMediaEditURL() {// FIXME: Needs real implementation
+void picasaPhoto::extractMediaEditURL() {
   mediaEditURL = "";
+  resumableEditURL = "";
+  if ( ! xml ) return;
+  try {
+    ticpp::Iterator< ticpp::Element > links("link");
+    for( links = links.begin( xml->FirstChildElement() ); links != links.end(); links++ ) {
+      if ( links->GetAttribute( "rel" ).compare("edit-media") == 0 )
+	mediaEditURL = links->GetAttribute( "href" );
+      if ( links->GetAttribute( "rel" ).compare("http://schemas.google.com/g/2005#resumable-edit-media") == 0 )
+	resumableEditURL = links->GetAttribute( "href" );
+    }
+  } catch ( ticpp::Exception &ex ) {
+    cerr << "picasaPhoto::extractMediaEditURL(): " << ex.what() << "\n";
+  }
 }
 
 picasaPhoto::picasaPhoto( atomEntry &entry ): atomEntry( entry ) { 
   extractMediaEditURL();
 }
 
+/* Large files are sent in chunks so that a broken connection does
+ * not mean starting over */
+bool picasaPhoto::uploadResumable( const string &fileName ) {
+  struct stat st;
+  if ( stat( fileName.c_str(), &st ) != 0 ) return false;
+  return ( st.st_size >= gAPI::resumableThreshold );
+}
+
+/* The title and summary are sent in the same request as the image data */
 picasaPhoto::picasaPhoto( gAPI *API, const string &fileName, const string &albumName, const string &Summary, const string &Title ) throw( enum atomObj::exceptionType ): 
 	atomEntry( API )
 {
@@ -52,24 +77,45 @@ picasaPhoto::picasaPhoto( gAPI *API, const string &fileName, const string &album
   if ( fileName.find(".jpg") == string::npos ) { 
       cerr << "picasaPhoto::picasaPhoto(...,"<<fileName<<"): Only jpeg's allowed at the moment.\n";
   }
-  list<string> hdrs;
   string myTitle = Title;
   if ( myTitle == "" ) {
     boost::filesystem::path pth( fileName );
     myTitle = pth.filename().string();
   }
-  hdrs.push_back("Slug: "+myTitle );
-  if ( ! loadFromXML(api->POST_FILE( url, fileName, "image/jpeg", hdrs ) ) ) throw atomObj::ERROR_CREATING_OBJECT;
-  if ( Summary != "" ) {
-    addOrSet( xml->FirstChildElement(), "summary", Summary );
-    atomEntry::UPDATE();
-  }
+  string entryXML = "<entry xmlns='http://www.w3.org/2005/Atom'>\
+                     <title></title>\
+                     <category scheme=\"http://schemas.google.com/g/2005#kind\"\
+                     term=\"http://schemas.google.com/photos/2007#photo\"/>\
+                     </entry>";
+  if ( ! loadFromXML( entryXML ) ) throw atomObj::ERROR_CREATING_OBJECT;
+  // Setting the values through the DOM takes care of escaping them
+  addOrSet( xml->FirstChildElement(), "title", myTitle );
+  if ( Summary != "" ) addOrSet( xml->FirstChildElement(), "summary", Summary );
+  string response;
+  if ( uploadResumable( fileName ) )
+    response = api->UPLOAD_RESUMABLE( picasaService::resumableNewPhotoURL( api->getUser(), albumName ), getStringXML(), fileName, "image/jpeg", uploadSessionFile( fileName ) );
+  else response = api->POST_MULTIPART( url, getStringXML(), fileName, "image/jpeg" );
+  if ( ! loadFromXML( response ) ) throw atomObj::ERROR_CREATING_OBJECT;
+  extractMediaEditURL();
 }
 
+/* Replaces the image data and pushes the (possibly modified) metadata
+ * along with it, in one request if the entry has an edit-media link
+ * (or chunked, if it is large and the entry allows resumable uploads) */
 bool picasaPhoto::upload( const std::string &fileName ) {
-  list<string> hdrs;
-  api->PUT_FILE( editURL, fileName, "image/jpeg", hdrs );
-  UPDATE();
+  string response;
+  if ( resumableEditURL != "" && uploadResumable( fileName ) )
+    response = api->UPLOAD_RESUMABLE( resumableEditURL, getStringXML(), fileName, "image/jpeg", uploadSessionFile( fileName ), false );
+  else if ( mediaEditURL != "" )
+    response = api->PUT_MULTIPART( mediaEditURL, getStringXML(), fileName, "image/jpeg" );
+  else {
+    list<string> hdrs;
+    if ( api->PUT_FILE( editURL, fileName, "image/jpeg", hdrs ) == "" ) return false;
+    return UPDATE();
+  }
+  if ( ! loadFromXML( response ) ) return false;
+  extractMediaEditURL();
+  return true;
 }
 
 string picasaPhoto::getSummary() const { 
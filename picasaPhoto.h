@@ -24,10 +24,13 @@ class gAPI;
 
 class picasaPhoto: public atomEntry { 
 	private:
-		std::string mediaEditURL;
+		std::string mediaEditURL, resumableEditURL;
 
 		void extractMediaEditURL();
 
+		static bool uploadResumable( const std::string &fileName );
+		static std::string uploadSessionFile( const std::string &fileName ) { return fileName + ".upload-session"; };
+
 	protected:
 		picasaPhoto( gAPI* api, const std::string& xml = "" );
 		picasaPhoto( atomEntry &entry );
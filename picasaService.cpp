@@ -11,6 +11,7 @@
  *CHANGES:
  ***************************************************************/
 #include <iostream>
+#include <boost/bind.hpp>
  
 #include "picasaService.h"
 #include "picasaAlbum.h"
@@ -25,16 +26,17 @@ picasaService::picasaService( gAPI *API ):
 {
 };
 
+void picasaService::collectAlbum( set<picasaAlbum> *albums, atomEntryPtr entry ) {
+  picasaAlbum album( *entry );
+  albums->insert( album );
+}
+
 set<picasaAlbum> picasaService::albumList( const string &user ) throw (enum exceptionType) {
   atomFeed albumFeed( api );
-  if ( ! albumFeed.loadFromURL( albumFeedURL( user ) ) ) {
-    throw GENERAL_ERROR;
-  }
-  list<atomEntryPtr> albums = albumFeed.getEntries();
   set<picasaAlbum> ret;
-  for(list<atomEntryPtr>::iterator a = albums.begin(); a != albums.end(); ++a) {
-    picasaAlbum album( **a );
-    ret.insert( album );
+  if ( ! albumFeed.streamPagedEntries( albumFeedURL( user ), boost::bind( &picasaService::collectAlbum, &ret, _1 ) ) ) {
+    // A page that failed or a feed changing meanwhile is worth another try
+    throw ( albumFeed.getStatus() == 404 ) ? NOT_FOUND : GENERAL_ERROR;
   }
   return ret;
 }
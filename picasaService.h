@@ -28,9 +28,14 @@ class picasaService {
 	private:
 	  gAPI *api;
 
+		static void collectAlbum( std::set<picasaAlbum> *albums, atomEntryPtr entry );
+
 		static std::string newPhotoURL( const std::string &user, const std::string &albumName ) { 
 		  return "http://picasaweb.google.com/data/feed/api/user/"+user+"/album/"+albumName;
 		}
+		static std::string resumableNewPhotoURL( const std::string &user, const std::string &albumName ) {
+		  return "http://picasaweb.google.com/data/upload/resumable/media/create-session/feed/api/user/"+user+"/album/"+albumName;
+		}
 		static std::string newCommentURL( const std::string &user, const std::string &albumID, const std::string &photoID, const std::string &authKey="" ) {
 		  std::string auth = "";
 		  if ( authKey.compare("") != 0 ) auth = "?authkey="+authKey;
@@ -63,7 +68,7 @@ class picasaService {
 
 	public:
 
-		enum exceptionType { GENERAL_ERROR };
+		enum exceptionType { GENERAL_ERROR, NOT_FOUND }; // NOT_FOUND only if the server said so
 
 	public:
 		picasaService( gAPI *API );
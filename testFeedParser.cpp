@@ -0,0 +1,117 @@
+/***************************************************************
+ * testFeedParser.cpp
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description:
+ * Usage: testFeedParser [feed.xml]
+ *        Without arguments runs the built-in test, otherwise prints
+ *        the entries found in the given feed.
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#include <boost/bind.hpp>
+
+#include "feedParser.h"
+
+using namespace std;
+
+static const char *FEED =
+  "<?xml version='1.0' encoding='UTF-8'?>\n"
+  "<feed xmlns='http://www.w3.org/2005/Atom' xmlns:gphoto='http://schemas.google.com/photos/2007'>"
+  "<title>Hory</title><link rel='self' href='http://example.com/feed?a=1&amp;b=2'/>"
+  "<!-- <entry>not an entry</entry> -->"
+  "<entry><title>a.jpg</title><gphoto:id>1</gphoto:id><summary><![CDATA[ends with </entry>]]></summary></entry>"
+  "<entry xmlns:gphoto='urn:other'><title attr='1>0'>b.jpg</title></entry>"
+  "<entry/>"
+  "</feed>";
+
+static void collect( vector<string> *entries, const string &entry ) {
+  entries->push_back( entry );
+}
+
+static void print( const string &entry ) {
+  cout << entry << "\n\n";
+}
+
+/* Parses the feed split into chunks of chunkSize bytes */
+static bool parseInChunks( size_t chunkSize, vector<string> &entries, string &feedXML ) {
+  feedParser parser( boost::bind( collect, &entries, _1 ) );
+  string feed( FEED );
+  for( size_t pos = 0; pos < feed.size(); pos += chunkSize )
+    parser.feed( feed.data() + pos, min( chunkSize, feed.size() - pos ) );
+  bool finished = parser.finish();
+  feedXML = parser.getFeedXML();
+  return finished;
+}
+
+bool testFeedParser() {
+  bool ok = true;
+  size_t sizes[] = { 1, 7, 4096 };
+  for( int i = 0; i < 3; i++ ) {
+    vector<string> entries;
+    string feedXML;
+    bool finished = parseInChunks( sizes[i], entries, feedXML );
+    bool count = ( entries.size() == 3 );
+    bool cdata = ( count && entries[0].find( "ends with </entry>]]></summary></entry>" ) != string::npos );
+    bool ns = ( count && entries[0].find( "<entry xmlns='http://www.w3.org/2005/Atom' xmlns:gphoto='http://schemas.google.com/photos/2007'>" ) == 0 );
+    bool ownNs = ( count && entries[1].find( "xmlns:gphoto='urn:other'" ) != string::npos && entries[1].find( "photos/2007" ) == string::npos
+		   && entries[1].find( "<title attr='1>0'>b.jpg</title></entry>" ) != string::npos );
+    bool empty = ( count && entries[2].find( "<entry xmlns=" ) == 0 && entries[2].find( "/>" ) == entries[2].size() - 2 );
+    bool head = ( feedXML.find( "<title>Hory</title>" ) != string::npos && feedXML.find( "a.jpg" ) == string::npos
+		  && feedXML.find( "</feed>" ) != string::npos && feedXML.find( "not an entry" ) != string::npos );
+    if ( ! ( finished && count && cdata && ns && ownNs && empty && head ) ) {
+      std::cerr << "testFeedParser FAILED for chunks of " << sizes[i] << " bytes (finished:" << finished << " count:" << count
+		<< " cdata:" << cdata << " ns:" << ns << " ownNs:" << ownNs << " empty:" << empty << " head:" << head << ")\n";
+      ok = false;
+    }
+  }
+
+  // A feed cut off in the middle of an entry
+  vector<string> entries;
+  feedParser truncated( boost::bind( collect, &entries, _1 ) );
+  string feed( FEED );
+  truncated.feed( feed.data(), feed.find( "b.jpg" ) );
+  if ( truncated.finish() || entries.size() != 1 ) {
+    std::cerr << "testFeedParser FAILED (truncated feed accepted)\n";
+    ok = false;
+  }
+
+  // Starting over after a reset gives the same entries again
+  truncated.reset();
+  entries.clear();
+  truncated.feed( feed.data(), feed.size() );
+  if ( ! truncated.finish() || entries.size() != 3 || truncated.entryCount() != 3 ) {
+    std::cerr << "testFeedParser FAILED (reset)\n";
+    ok = false;
+  }
+
+  if ( ok ) std::cerr << "testFeedParser PASSED\n";
+  return ok;
+}
+
+int main( int argc, char **argv ) {
+  if ( argc > 1 ) {
+    ifstream in( argv[1] );
+    feedParser parser( print );
+    char chunk[4096];
+    while( in.read( chunk, sizeof(chunk) ) || in.gcount() > 0 ) parser.feed( chunk, in.gcount() );
+    if ( ! parser.finish() ) cerr << argv[1] << ": truncated feed\n";
+    cout << "Feed without entries:\n" << parser.getFeedXML() << "\n";
+    return 0;
+  }
+  if ( testFeedParser() ) {
+    return 0;
+  } else {
+    exit(1);
+  }
+}
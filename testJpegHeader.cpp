@@ -0,0 +1,107 @@
+/***************************************************************
+ * testJpegHeader.cpp
+ * @Author:      Jonathan Verner (jonathan.verner@matfyz.cz)
+ * @License:     GPL v2.0 or later
+ * @Created:     2026-10-19.
+ * @Last Change: 2026-10-19.
+ * @Revision:    0.0
+ * Description:
+ * Usage: testJpegHeader [file.jpg ...]
+ *        Without arguments runs the built-in test, otherwise prints
+ *        the metadata found in the given files.
+ * TODO:
+ *CHANGES:
+ ***************************************************************/
+
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+
+#include "jpegHeader.h"
+
+using namespace std;
+
+static void segment( string &jpg, unsigned char marker, const string &payload ) {
+  size_t len = payload.size() + 2;
+  jpg += (char) 0xFF;
+  jpg += (char) marker;
+  jpg += (char) ( len >> 8 );
+  jpg += (char) ( len & 0xFF );
+  jpg += payload;
+}
+
+/* A big endian EXIF block with IFD0 = { Orientation = 6, ExifIFD }, ExifIFD = { DateTimeOriginal } */
+static string exifPayload() {
+  const unsigned char tiff[] = {
+    'M','M', 0x00,0x2A, 0x00,0x00,0x00,0x08,
+    0x00,0x02,
+      0x01,0x12, 0x00,0x03, 0x00,0x00,0x00,0x01, 0x00,0x06,0x00,0x00,
+      0x87,0x69, 0x00,0x04, 0x00,0x00,0x00,0x01, 0x00,0x00,0x00,0x26,
+    0x00,0x00,0x00,0x00,
+    0x00,0x01,
+      0x90,0x03, 0x00,0x02, 0x00,0x00,0x00,0x14, 0x00,0x00,0x00,0x38,
+    0x00,0x00,0x00,0x00
+  };
+  string ret( "Exif\0\0", 6 );
+  ret.append( (const char *) tiff, sizeof(tiff) );
+  ret.append( "2009:08:01 12:34:56", 20 );
+  return ret;
+}
+
+bool testJpegHeader() {
+  string jpg( "\xFF\xD8", 2 );
+  segment( jpg, 0xE0, string( "JFIF\0\x01\x01\0\0\x01\0\x01\0\0", 14 ) );
+  segment( jpg, 0xE1, exifPayload() );
+  jpg += (char) 0xFF; // a fill byte
+  segment( jpg, 0xFE, "Na horach" );
+  segment( jpg, 0xC0, string( "\x08\x0B\xB8\x0F\xA0\x03", 6 ) );
+  segment( jpg, 0xDA, string( "\x03\x01\x00", 3 ) );
+  jpg += string( "\x12\xFF\x00\xFF\xFE\x00\x03xx", 9 ); // entropy coded data which looks like a COM segment
+  jpg += string( "\xFF\xD9", 2 );
+
+  jpegHeader hdr;
+  bool parsed = hdr.parse( jpg.data(), jpg.size() );
+  bool comment = ( hdr.getComment() == "Na horach" );
+  bool orientation = ( hdr.getOrientation() == 6 );
+  bool captureTime = ( hdr.getCaptureTime() == "2009:08:01 12:34:56" );
+  bool dimensions = ( hdr.getWidth() == 4000 && hdr.getHeight() == 3000 );
+
+  jpegHeader notJpeg;
+  string png( "\x89PNG\r\n\x1a\n", 8 );
+  bool rejected = ! notJpeg.parse( png.data(), png.size() );
+
+  jpegHeader truncated;
+  truncated.parse( jpg.data(), 30 );
+
+  if ( parsed && comment && orientation && captureTime && dimensions && rejected && truncated.getComment() == "" ) {
+    std::cerr << "testJpegHeader PASSED\n";
+    return true;
+  }
+  std::cerr << "testJpegHeader FAILED (parsed:" << parsed << " comment:" << comment << " orientation:" << orientation
+	    << " captureTime:" << captureTime << " dimensions:" << dimensions << " rejected:" << rejected << ")\n";
+  return false;
+}
+
+int main( int argc, char **argv ) {
+  if ( argc > 1 ) {
+    for( int i = 1; i < argc; i++ ) {
+      jpegHeader hdr;
+      if ( ! hdr.load( argv[i] ) ) {
+	cerr << argv[i] << ": not a JPEG file\n";
+	continue;
+      }
+      cout << argv[i] << ":\n";
+      cout << "  Size: " << hdr.getWidth() << "x" << hdr.getHeight() << "\n";
+      cout << "  Orientation: " << hdr.getOrientation() << "\n";
+      cout << "  Taken: " << hdr.getCaptureTime() << "\n";
+      cout << "  Comment: " << hdr.getComment() << "\n";
+      cout << "  Description: " << hdr.getDescription() << "\n";
+    }
+    return 0;
+  }
+  if ( testJpegHeader() ) {
+    return 0;
+  } else {
+    exit(1);
+  }
+}